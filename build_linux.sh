@@ -0,0 +1,23 @@
+#!/bin/bash
+
+DIR_PATH="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )";
+cd "$DIR_PATH";
+
+mkdir -p build
+
+OUTPUT="-o build/linux"
+
+CPP_FILES="src/*.cpp src/scenes/*.cpp src/scenes/scene_game/*.cpp src/platform/platform_linux.cpp"
+
+LIBS="-lEGL -lGL -lfreetype -lpthread"
+INCLUDE_PATH="-I libs/include"
+
+DEF="-DPLATFORM_LINUX -DDEBUG=0 -DSSE_SUPPORT=1"
+
+g++ -g -O2 -std=c++14 $INCLUDE_PATH $DEF $CPP_FILES $LIBS $OUTPUT
+
+# Benchmarks (these do not create a window or an opengl context):
+REGION_FILES="src/scenes/scene_game/*.cpp src/shader.cpp src/profiler.cpp src/job_system.cpp"
+
+g++ -g -O2 -std=c++14 $INCLUDE_PATH $DEF src/benchmark/bench_water.cpp $REGION_FILES $LIBS -o build/bench_water
+g++ -g -O2 -std=c++14 $INCLUDE_PATH $DEF src/benchmark/bench_mesh.cpp $REGION_FILES $LIBS -o build/bench_mesh
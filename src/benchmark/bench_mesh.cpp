@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../profiler.hpp"
+#include "../scenes/scene_game/region.hpp"
+
+////////////////////////////
+// NOTE(Xavier): (2018.1.7) This benchmark times the chunk mesh
+// builders for every chunk of a generated region, for both the
+// layered & full variants and all four view directions.
+// Like the game's generation thread it runs without an opengl
+// context, the produced mesh data is measured and then discarded.
+
+struct Mesh_Stats
+{
+	uint64_t chunks = 0;
+	uint64_t microseconds = 0;
+	uint64_t vertices = 0;
+	uint64_t bytes = 0;
+};
+
+//////////////////////////////////
+// This function removes the mesh data
+// that the builders have queued for upload
+// and adds its size to the stats.
+static void drain_mesh_data ( Region *region, Mesh_Stats *stats )
+{
+	Chunk_Mesh_Data data;
+	while ( spsc_ring_pop( &region->meshRings[0], &data ) ) {
+		stats->vertices += data.vertexData.size() / 5;
+		stats->bytes += data.vertexData.capacity() * sizeof(float);
+		stats->bytes += data.indexData.capacity() * sizeof(uint32_t);
+		stats->bytes += data.layeredIndexCount.capacity() * sizeof(uint32_t);
+	}
+}
+
+
+//////////////////////////////////
+// Usage: bench_mesh [-seed S] [-ticks N] [-size L W H] [-chunk CL CW CH] [-repeat R]
+int main ( int argc, const char *argv[] )
+{
+	uint64_t seed = 1;
+	uint32_t ticks = 0;
+	uint32_t repeat = 1;
+	uint32_t wl = 4, ww = 4, wh = 6;
+	uint32_t cl = 32, cw = 32, ch = 32;
+
+	for ( int i = 1; i < argc; ++i ) {
+		if ( strcmp( argv[i], "-seed" ) == 0 && i+1 < argc ) seed = strtoull( argv[++i], nullptr, 10 );
+		else if ( strcmp( argv[i], "-ticks" ) == 0 && i+1 < argc ) ticks = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-repeat" ) == 0 && i+1 < argc ) repeat = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-size" ) == 0 && i+3 < argc ) { wl = atoi( argv[++i] ); ww = atoi( argv[++i] ); wh = atoi( argv[++i] ); }
+		else if ( strcmp( argv[i], "-chunk" ) == 0 && i+3 < argc ) { cl = atoi( argv[++i] ); cw = atoi( argv[++i] ); ch = atoi( argv[++i] ); }
+		else {
+			printf( "Usage: %s [-seed S] [-ticks N] [-size L W H] [-chunk CL CW CH] [-repeat R]\n", argv[0] );
+			return 1;
+		}
+	}
+
+	Region *region = new Region;
+	region_init_data( region, cl, cw, ch, wl, ww, wh, 1 );
+	region->seed = seed;
+	region_generate( region );
+
+	// Optionally let the water settle so the water meshes are representative:
+	for ( uint32_t tick = 0; tick < ticks; ++tick ) region_simulate( region );
+
+	typedef void (*Mesh_Builder)( Region*, uint32_t, uint32_t, bool );
+	const Mesh_Builder builders [3] = { build_floor_mesh, build_wall_mesh, build_water_mesh };
+	const char *builderNames [3] = { "floor", "wall", "water" };
+	const char *directionNames [5] = { "", "north", "east", "south", "west" };
+
+	printf( "region: %ux%ux%u chunks of %ux%ux%u, seed %llu, %u water ticks\n", wl, ww, wh, cl, cw, ch, (unsigned long long)seed, ticks );
+	printf( "%-6s %-5s %-6s %12s %14s %14s\n", "mesh", "full", "dir", "chunks/sec", "vertices/sec", "bytes/chunk" );
+
+	Mesh_Stats totals;
+	const uint32_t chunkCount = wl*ww*wh;
+
+	for ( uint32_t b = 0; b < 3; ++b ) {
+		for ( uint32_t full = 0; full < 2; ++full ) {
+			for ( uint32_t direction = Direction::D_NORTH; direction <= Direction::D_WEST; ++direction ) {
+				region->viewDirection = direction;
+
+				Mesh_Stats stats;
+				for ( uint32_t r = 0; r < repeat; ++r ) {
+					for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+						uint64_t startTime = Profiler::get_time();
+						builders[b]( region, 0, chunk, full != 0 );
+						stats.microseconds += Profiler::get_time() - startTime;
+						stats.chunks++;
+						drain_mesh_data( region, &stats );
+					}
+				}
+
+				double seconds = stats.microseconds / 1000000.0;
+				printf( "%-6s %-5s %-6s %12.1f %14.0f %14llu\n", builderNames[b], full ? "yes" : "no", directionNames[direction],
+					stats.chunks / seconds, stats.vertices / seconds, (unsigned long long)(stats.bytes / stats.chunks) );
+
+				totals.chunks += stats.chunks;
+				totals.microseconds += stats.microseconds;
+				totals.vertices += stats.vertices;
+				totals.bytes += stats.bytes;
+			}
+		}
+	}
+
+	double seconds = totals.microseconds / 1000000.0;
+	printf( "%-19s %12.1f %14.0f %14llu\n", "total", totals.chunks / seconds, totals.vertices / seconds, (unsigned long long)(totals.bytes / totals.chunks) );
+
+	// A full rotate rebuilds all six meshes of every chunk:
+	printf( "full region remesh: %.3f ms per direction\n", totals.microseconds / 1000.0 / (4 * repeat) );
+
+	region_cleanup_data( region );
+	delete region;
+
+	return 0;
+}
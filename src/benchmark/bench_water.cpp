@@ -0,0 +1,245 @@
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "../profiler.hpp"
+#include "../scenes/scene_game/region.hpp"
+
+////////////////////////////
+// NOTE(Xavier): (2018.1.7) This benchmark runs the water simulation
+// of a region without any opengl context or extra threads (other
+// than the water's own workers, see '-threads').
+// The region is generated from a fixed seed, so two runs with the
+// same arguments perform exactly the same work, and the final
+// checksum can be compared to check that an optimisation did not
+// change the simulation's result. The checksum does not depend on
+// the number of threads, but it does depend on '-sleep' (0 turns
+// sleeping water off) & '-dense' (above 1 turns the dense path off).
+// A '-budget' makes the result depend on timing, as the water that
+// does not fit in a tick is carried over to the next one.
+// '-edits' sets that many random floors & walls before the ticks (with
+// the water paused), the checksum then also depends on it.
+// '-lake' replaces the wave with a lake on a flat floor in the top layer,
+// its depth a sawtooth along x, and checks that it ends up level (the
+// exit code is 2 if not). It needs a few thousand ticks, so they default
+// to 6000 with '-lake'.
+
+//////////////////////////////////
+// Returns the peak resident set size in kilobytes.
+static long get_peak_rss ()
+{
+	rusage usage;
+	getrusage( RUSAGE_SELF, &usage );
+	return usage.ru_maxrss;
+}
+
+//////////////////////////////////
+// FNV-1a hash of all the water in the region.
+static uint32_t water_checksum ( Region *region )
+{
+	uint32_t hash = 2166136261u;
+	for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
+		for ( uint32_t j = 0; j < region->chunkLength*region->chunkWidth*region->chunkHeight; ++j ) {
+			hash ^= region->chunks[i].water[j];
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+//////////////////////////////////
+// NOTE(Xavier): (2018.1.14) The lake is level once no cell is more than
+// a unit deeper than the one next to it, & all its depths are within this
+// of each other. A slope of a unit every few cells is allowed as it moves
+// too little to wake the water (see 'WATER_SLEEP_DEAD_BAND').
+static const int LAKE_LEVEL = 16;
+
+//////////////////////////////////
+// Returns the lowest & highest depth of water
+// in a layer, & the largest difference between
+// two cells next to each other.
+static void get_water_range ( Region *region, int z, int *low, int *high, int *step )
+{
+	auto get_water = [&]( int x, int y ) -> int {
+		const uint32_t i = (x % region->chunkLength) + (y % region->chunkWidth)*region->chunkLength + (z % region->chunkHeight)*region->chunkLength*region->chunkWidth;
+		return region->chunks[ region_get_chunk_index( region, x, y, z ) ].water[ i ];
+	};
+
+	*low = 255;
+	*high = 0;
+	*step = 0;
+	for ( int y = 0; y < (int)region->worldWidth; ++y ) {
+		for ( int x = 0; x < (int)region->worldLength; ++x ) {
+			const int depth = get_water( x, y );
+			*low = std::min( *low, depth );
+			*high = std::max( *high, depth );
+			if ( x+1 < (int)region->worldLength ) *step = std::max( *step, abs( depth - get_water( x+1, y ) ) );
+			if ( y+1 < (int)region->worldWidth ) *step = std::max( *step, abs( depth - get_water( x, y+1 ) ) );
+		}
+	}
+}
+
+//////////////////////////////////
+// Returns the bytes used by the floors &
+// walls of the chunks (their slots in the
+// arena & what they allocated on top), &
+// the bytes they would use at 4 bytes per tile.
+static void get_tile_memory ( Region *region, uint64_t *bytes, uint64_t *rawBytes )
+{
+	*bytes = 0;
+	*rawBytes = 0;
+	for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
+		*bytes += palette_array_memory( &region->chunks[i].floor ) + palette_array_memory( &region->chunks[i].wall );
+		*bytes += (region->chunks[i].floor.slotWordCount + region->chunks[i].wall.slotWordCount) * sizeof(uint64_t);
+		*rawBytes += (region->chunks[i].floor.count + region->chunks[i].wall.count) * sizeof(uint32_t);
+	}
+}
+
+
+//////////////////////////////////
+// Usage: bench_water [-seed S] [-ticks N] [-size L W H] [-chunk CL CW CH] [-threads T] [-sleep K] [-dense F] [-budget US] [-edits E] [-lake] [-csv]
+int main ( int argc, const char *argv[] )
+{
+	uint64_t seed = 1;
+	uint32_t ticks = 500;
+	uint32_t wl = 4, ww = 4, wh = 6;
+	uint32_t cl = 32, cw = 32, ch = 32;
+	uint32_t threads = 1;
+	int sleepTicks = -1;
+	float denseFraction = -1;
+	uint32_t budget = 0;
+	uint32_t edits = 0;
+	bool lake = false;
+	bool ticksGiven = false;
+	bool csv = false;
+
+	for ( int i = 1; i < argc; ++i ) {
+		if ( strcmp( argv[i], "-seed" ) == 0 && i+1 < argc ) seed = strtoull( argv[++i], nullptr, 10 );
+		else if ( strcmp( argv[i], "-ticks" ) == 0 && i+1 < argc ) { ticks = atoi( argv[++i] ); ticksGiven = true; }
+		else if ( strcmp( argv[i], "-size" ) == 0 && i+3 < argc ) { wl = atoi( argv[++i] ); ww = atoi( argv[++i] ); wh = atoi( argv[++i] ); }
+		else if ( strcmp( argv[i], "-chunk" ) == 0 && i+3 < argc ) { cl = atoi( argv[++i] ); cw = atoi( argv[++i] ); ch = atoi( argv[++i] ); }
+		else if ( strcmp( argv[i], "-threads" ) == 0 && i+1 < argc ) threads = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-sleep" ) == 0 && i+1 < argc ) sleepTicks = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-dense" ) == 0 && i+1 < argc ) denseFraction = atof( argv[++i] );
+		else if ( strcmp( argv[i], "-budget" ) == 0 && i+1 < argc ) budget = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-edits" ) == 0 && i+1 < argc ) edits = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-lake" ) == 0 ) lake = true;
+		else if ( strcmp( argv[i], "-csv" ) == 0 ) csv = true;
+		else {
+			printf( "Usage: %s [-seed S] [-ticks N] [-size L W H] [-chunk CL CW CH] [-threads T] [-sleep K] [-dense F] [-budget US] [-edits E] [-lake] [-csv]\n", argv[0] );
+			return 1;
+		}
+	}
+	if ( lake && !ticksGiven ) ticks = 6000;
+
+	Region *region = new Region;
+	region_init_data( region, cl, cw, ch, wl, ww, wh, 1 );
+	region->seed = seed;
+	region->waterThreadCount = threads > 0 ? threads : 1;
+	if ( sleepTicks >= 0 ) region->waterSleepTicks = sleepTicks;
+	if ( denseFraction >= 0 ) region->waterDenseFraction = denseFraction;
+	region->waterTickBudget = budget;
+
+	uint64_t startTime = Profiler::get_time();
+	region_generate( region );
+	uint64_t generationTime = Profiler::get_time() - startTime;
+
+	// The edits are sent in batches that fit in the command queue:
+	Random random;
+	random_seed( &random, seed );
+	uint64_t editTime = 0;
+	region->simulationPaused = true;
+	for ( uint32_t sent = 0; sent < edits; ) {
+		for ( uint32_t i = 0; i < 512 && sent < edits; ++i, ++sent ) {
+			Region_Command command;
+			command.type = random_range( &random, 2 ) == 0 ? Region_Command_Type::SET_FLOOR : Region_Command_Type::SET_WALL;
+			command.x = random_range( &random, region->worldLength );
+			command.y = random_range( &random, region->worldWidth );
+			command.z = random_range( &random, region->worldHeight );
+			command.tile = random_range( &random, 2 ) == 0 ? 0 : (command.type == Region_Command_Type::SET_FLOOR ? (uint32_t)Floor::FLOOR_STONE : (uint32_t)Wall::WALL_STONE);
+			region_issue_command( region, command );
+		}
+		startTime = Profiler::get_time();
+		region_simulate( region );
+		editTime += Profiler::get_time() - startTime;
+	}
+
+	// The lake's floor is stone & its cells are open, so only the depths differ:
+	const int lakeZ = region->worldHeight - 1;
+	for ( uint32_t sent = 0; lake && sent < region->worldLength*region->worldWidth; ) {
+		for ( uint32_t i = 0; i < 256 && sent < region->worldLength*region->worldWidth; ++i, ++sent ) {
+			Region_Command command;
+			command.x = sent % region->worldLength;
+			command.y = sent / region->worldLength;
+			command.z = lakeZ;
+			command.type = Region_Command_Type::SET_FLOOR;
+			command.tile = (uint32_t)Floor::FLOOR_STONE;
+			region_issue_command( region, command );
+			command.type = Region_Command_Type::SET_WALL;
+			command.tile = (uint32_t)Wall::WALL_NONE;
+			region_issue_command( region, command );
+			command.type = Region_Command_Type::SET_WATER;
+			command.amount = 30 + 3*(command.x % 64);
+			region_issue_command( region, command );
+		}
+		region_simulate( region );
+	}
+	region->simulationPaused = false;
+
+	if ( !lake ) region_issue_command( region, {Region_Command_Type::ADD_WATER_WAVE} );
+
+	if ( csv ) printf( "tick,us,active,sleeping,dense,carried\n" );
+
+	uint64_t totalActive = 0;
+	uint32_t peakActive = 0;
+	uint64_t totalDense = 0;
+	uint64_t totalCarriedOver = 0;
+	startTime = Profiler::get_time();
+	for ( uint32_t tick = 0; tick < ticks; ++tick ) {
+		uint64_t tickStartTime = Profiler::get_time();
+		region_simulate( region );
+		uint64_t tickTime = Profiler::get_time() - tickStartTime;
+
+		uint32_t active = region->numberOfWaterBeingUpdated;
+		totalActive += active;
+		totalDense += region->numberOfDenseWaterChunks;
+		totalCarriedOver += region->numberOfWaterCarriedOver;
+		if ( active > peakActive ) peakActive = active;
+		if ( csv ) printf( "%u,%llu,%u,%u,%u,%u\n", tick, (unsigned long long)tickTime, active, (uint32_t)region->numberOfWaterSleeping, (uint32_t)region->numberOfDenseWaterChunks, (uint32_t)region->numberOfWaterCarriedOver );
+	}
+	uint64_t simulationTime = Profiler::get_time() - startTime;
+
+	printf( "region:        %ux%ux%u chunks of %ux%ux%u\n", wl, ww, wh, cl, cw, ch );
+	printf( "seed:          %llu\n", (unsigned long long)seed );
+	printf( "water threads: %u\n", region->waterThreadCount );
+	printf( "sleep ticks:   %u\n", region->waterSleepTicks );
+	printf( "generate:      %.3f ms\n", generationTime / 1000.0 );
+	if ( edits ) printf( "edits:         %u in %.3f ms\n", edits, editTime / 1000.0 );
+	printf( "ticks:         %u in %.3f ms\n", ticks, simulationTime / 1000.0 );
+	printf( "ticks/sec:     %.2f\n", ticks / (simulationTime / 1000000.0) );
+	printf( "active/tick:   avg %llu, peak %u, last %u\n", (unsigned long long)(ticks ? totalActive / ticks : 0), peakActive, (uint32_t)region->numberOfWaterBeingUpdated );
+	printf( "sleeping:      %u\n", (uint32_t)region->numberOfWaterSleeping );
+	printf( "dense/tick:    avg %.2f chunks (fraction %.2f)\n", ticks ? totalDense / (double)ticks : 0.0, region->waterDenseFraction );
+	printf( "carried/tick:  avg %llu (budget %u us)\n", (unsigned long long)(ticks ? totalCarriedOver / ticks : 0), region->waterTickBudget );
+	uint64_t tileBytes, rawTileBytes;
+	get_tile_memory( region, &tileBytes, &rawTileBytes );
+	printf( "tile memory:   %llu KB (%llu KB unpacked)\n", (unsigned long long)(tileBytes / 1024), (unsigned long long)(rawTileBytes / 1024) );
+	printf( "chunk arena:   %llu KB\n", (unsigned long long)(region->chunkArenaSize / 1024) );
+	printf( "peak rss:      %ld KB\n", get_peak_rss() );
+	printf( "checksum:      %08x\n", water_checksum( region ) );
+	bool level = true;
+	if ( lake ) {
+		int low, high, step;
+		get_water_range( region, lakeZ, &low, &high, &step );
+		level = step <= 1 && high - low <= LAKE_LEVEL;
+		printf( "lake depth:    %d to %d, steps up to %d (%s)\n", low, high, step, level ? "level" : "NOT LEVEL" );
+	}
+	printf( "ZONE: MIN/AVG/P99\n%s", Profiler::get_report().c_str() );
+
+	region_cleanup_data( region );
+	delete region;
+
+	return level ? 0 : 2;
+}
@@ -0,0 +1,246 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+#include "job_system.hpp"
+
+struct Job_Counter
+{
+	std::atomic<uint32_t> count { 0 }; // The jobs added with this counter that have not finished.
+};
+
+struct Job
+{
+	Job_Function function;
+	void *data;
+	Job_Counter *done; // Decremented once the job has finished (can be null).
+};
+
+struct Timed_Job
+{
+	Job job;
+	uint64_t time; // Microseconds on the steady clock.
+};
+
+struct Job_System
+{
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable workReady;
+	std::condition_variable counterDone; // Notified every time a counter reaches zero.
+	bool terminate = false;
+
+	std::deque<Job> ready; // The jobs that can be run, in the order they should be run.
+	std::vector<Timed_Job> timed; // The jobs waiting for their time to pass.
+};
+
+// The items of a 'job_system_run' call:
+struct Job_Batch
+{
+	Job_Item_Function function;
+	void *data;
+	uint32_t count;
+	std::atomic<uint32_t> nextItem;
+	Job_Counter helpers;
+};
+
+
+//////////////////////////////////
+// This function must be called with the
+// mutex locked once a job has finished.
+static void finish_job ( Job_System *system, const Job& job )
+{
+	if ( job.done == nullptr ) return;
+	if ( --job.done->count == 0 ) system->counterDone.notify_all();
+}
+
+//////////////////////////////////
+static uint64_t get_time ()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>( now ).count();
+}
+
+//////////////////////////////////
+// This function must be called with the mutex
+// locked. It moves the timed jobs that are due
+// to the front of the ready jobs & returns the
+// time the next one is due (0 if there is none).
+static uint64_t release_due_jobs ( Job_System *system )
+{
+	if ( system->timed.empty() ) return 0;
+
+	const uint64_t now = get_time();
+	uint64_t nextTime = 0;
+	for ( size_t i = 0; i < system->timed.size(); ) {
+		if ( system->timed[i].time <= now ) {
+			system->ready.push_front( system->timed[i].job );
+			system->timed[i] = system->timed.back();
+			system->timed.pop_back();
+		}
+		else {
+			if ( nextTime == 0 || system->timed[i].time < nextTime ) nextTime = system->timed[i].time;
+			++i;
+		}
+	}
+	return nextTime;
+}
+
+//////////////////////////////////
+// This function runs items of the batch
+// until there are none left.
+static void run_batch_items ( Job_Batch *batch )
+{
+	for ( ;; ) {
+		uint32_t item = batch->nextItem++;
+		if ( item >= batch->count ) break;
+		batch->function( batch->data, item );
+	}
+}
+
+//////////////////////////////////
+static void batch_job ( void *data, uint32_t /*thread*/ )
+{
+	run_batch_items( (Job_Batch*)data );
+}
+
+//////////////////////////////////
+static void worker_thread_entry ( Job_System *system, uint32_t thread )
+{
+	std::unique_lock<std::mutex> lock( system->mutex );
+	for ( ;; ) {
+		const uint64_t nextTime = release_due_jobs( system );
+		if ( system->terminate ) break;
+		if ( system->ready.empty() ) {
+			if ( nextTime == 0 ) system->workReady.wait( lock );
+			else system->workReady.wait_until( lock, std::chrono::steady_clock::time_point( std::chrono::microseconds( nextTime ) ) );
+			continue;
+		}
+
+		Job job = system->ready.front();
+		system->ready.pop_front();
+
+		lock.unlock();
+		job.function( job.data, thread );
+		lock.lock();
+
+		finish_job( system, job );
+	}
+}
+
+
+//////////////////////////////////
+Job_System* job_system_create ( uint32_t workers )
+{
+	Job_System *system = new Job_System;
+	for ( uint32_t i = 0; i < workers; ++i ) {
+		system->threads.emplace_back( worker_thread_entry, system, i );
+	}
+	return system;
+}
+
+//////////////////////////////////
+// The jobs that have not been
+// started are thrown away.
+void job_system_destroy ( Job_System *system )
+{
+	if ( system == nullptr ) return;
+
+	system->mutex.lock();
+	system->terminate = true;
+	system->mutex.unlock();
+	system->workReady.notify_all();
+
+	for ( auto& thread : system->threads ) thread.join();
+	delete system;
+}
+
+//////////////////////////////////
+// Returns the number of threads that
+// can run jobs, including the helping one.
+uint32_t job_system_get_thread_count ( Job_System *system )
+{
+	return system->threads.size() + 1;
+}
+
+//////////////////////////////////
+void job_system_add ( Job_System *system, Job_Function function, void *data )
+{
+	std::lock_guard<std::mutex> lock( system->mutex );
+	system->ready.push_back( { function, data, nullptr } );
+	system->workReady.notify_one();
+}
+
+//////////////////////////////////
+void job_system_add_at ( Job_System *system, uint64_t time, Job_Function function, void *data )
+{
+	std::lock_guard<std::mutex> lock( system->mutex );
+	system->timed.push_back( { { function, data, nullptr }, time } );
+	// The idle workers may be sleeping until a later time:
+	system->workReady.notify_all();
+}
+
+//////////////////////////////////
+// The jobs that are added while it runs are left
+// for the next call, so a job that adds itself
+// again does not keep the caller here.
+void job_system_help ( Job_System *system )
+{
+	const uint32_t thread = system->threads.size();
+
+	std::unique_lock<std::mutex> lock( system->mutex );
+	release_due_jobs( system );
+	for ( size_t jobs = system->ready.size(); jobs != 0 && !system->ready.empty(); --jobs ) {
+		Job job = system->ready.front();
+		system->ready.pop_front();
+
+		lock.unlock();
+		job.function( job.data, thread );
+		lock.lock();
+
+		finish_job( system, job );
+	}
+}
+
+//////////////////////////////////
+// The items are given to the idle workers before any
+// queued job, the workers that are busy with another
+// job when the caller runs out of items are not waited for.
+void job_system_run ( Job_System *system, uint32_t count, Job_Item_Function function, void *data )
+{
+	if ( count == 0 ) return;
+
+	// Waking the workers costs more than a single item:
+	if ( count == 1 || system->threads.empty() ) {
+		for ( uint32_t i = 0; i < count; ++i ) function( data, i );
+		return;
+	}
+
+	Job_Batch batch;
+	batch.function = function;
+	batch.data = data;
+	batch.count = count;
+	batch.nextItem = 0;
+
+	const uint32_t helpers = count-1 < system->threads.size() ? count-1 : system->threads.size();
+	{
+		std::lock_guard<std::mutex> lock( system->mutex );
+		batch.helpers.count = helpers;
+		for ( uint32_t i = 0; i < helpers; ++i ) system->ready.push_front( { batch_job, &batch, &batch.helpers } );
+	}
+	system->workReady.notify_all();
+
+	run_batch_items( &batch );
+
+	std::unique_lock<std::mutex> lock( system->mutex );
+	for ( auto it = system->ready.begin(); it != system->ready.end(); ) {
+		if ( it->data == &batch ) { it = system->ready.erase( it ); batch.helpers.count--; }
+		else ++it;
+	}
+	system->counterDone.wait( lock, [&]{ return batch.helpers.count == 0; } );
+}
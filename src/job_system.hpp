@@ -0,0 +1,43 @@
+#ifndef _JOB_SYSTEM_HPP_
+#define _JOB_SYSTEM_HPP_
+
+#include <cstdint>
+
+/////////////////////////////////
+// NOTE(Xavier): (2018.1.12) The job system is a fixed set of worker
+// threads that run jobs from a shared queue, in the order they were added.
+// A job is told the index of the thread running it, each thread has its
+// own index in [0, thread count), the workers come first & the last index
+// is used by the thread calling 'job_system_help'.
+// 'job_system_run' splits a number of independent items between the calling
+// thread & any idle workers, the caller also works on the items so it makes
+// progress even when all the workers are busy. Idle workers sleep on a
+// condition variable.
+//
+// NOTE(Xavier): (2018.1.14) A job can also be added for a time, an idle
+// worker sleeps until the earliest of them is due & then runs it before
+// the other queued jobs, so work that repeats at a fixed rate (eg. the
+// simulation ticks) can add its next run itself.
+struct Job_System;
+
+typedef void (*Job_Function)( void *data, uint32_t thread );
+typedef void (*Job_Item_Function)( void *data, uint32_t item );
+
+Job_System* job_system_create ( uint32_t workers );
+void job_system_destroy ( Job_System *system );
+uint32_t job_system_get_thread_count ( Job_System *system );
+
+void job_system_add ( Job_System *system, Job_Function function, void *data );
+
+// Adds a job that is run once 'time' has passed. The time is in microseconds
+// on the steady clock (the same as 'Profiler::get_time').
+void job_system_add_at ( Job_System *system, uint64_t time, Job_Function function, void *data );
+
+// Runs the jobs that are queued or due when it is called on the calling thread.
+void job_system_help ( Job_System *system );
+
+// Calls 'function( data, i )' for every i in [0, count) &
+// returns once they have all finished.
+void job_system_run ( Job_System *system, uint32_t count, Job_Item_Function function, void *data );
+
+#endif
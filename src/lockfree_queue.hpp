@@ -0,0 +1,196 @@
+#ifndef _LOCKFREE_QUEUE_HPP_
+#define _LOCKFREE_QUEUE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+/////////////////////////////////
+// NOTE(Xavier): (2018.1.8) This is a bounded queue that any number
+// of threads can push to & pop from without taking a lock.
+// Each cell has a sequence number that tells a thread whether the
+// cell is ready to be written (sequence == position) or read
+// (sequence == position+1), so a thread only has to win one
+// compare exchange on the queue's position to own a cell.
+// The capacity is rounded up to a power of two.
+template <typename T>
+struct Lockfree_Queue
+{
+	struct Cell
+	{
+		std::atomic<uint32_t> sequence;
+		T data;
+	};
+
+	Cell *cells = nullptr;
+	uint32_t mask = 0;
+
+	// The positions are kept on separate cache lines so pushing
+	// threads do not slow down popping threads:
+	uint8_t padding0 [64];
+	std::atomic<uint32_t> pushPosition;
+	uint8_t padding1 [64];
+	std::atomic<uint32_t> popPosition;
+	uint8_t padding2 [64];
+};
+
+/////////////////////////////////
+template <typename T>
+inline void lockfree_queue_init ( Lockfree_Queue<T> *queue, uint32_t capacity )
+{
+	uint32_t size = 2;
+	while ( size < capacity ) size <<= 1;
+
+	queue->cells = new typename Lockfree_Queue<T>::Cell [size];
+	for ( uint32_t i = 0; i < size; ++i ) queue->cells[i].sequence.store( i, std::memory_order_relaxed );
+	queue->mask = size - 1;
+	queue->pushPosition.store( 0, std::memory_order_relaxed );
+	queue->popPosition.store( 0, std::memory_order_relaxed );
+}
+
+/////////////////////////////////
+template <typename T>
+inline void lockfree_queue_free ( Lockfree_Queue<T> *queue )
+{
+	delete [] queue->cells;
+	queue->cells = nullptr;
+	queue->mask = 0;
+}
+
+/////////////////////////////////
+// Returns false if the queue is full.
+template <typename T>
+inline bool lockfree_queue_push ( Lockfree_Queue<T> *queue, const T& value )
+{
+	typename Lockfree_Queue<T>::Cell *cell;
+	uint32_t position = queue->pushPosition.load( std::memory_order_relaxed );
+
+	for ( ;; ) {
+		cell = &queue->cells[ position & queue->mask ];
+		int32_t difference = (int32_t)(cell->sequence.load( std::memory_order_acquire ) - position);
+
+		if ( difference == 0 ) {
+			if ( queue->pushPosition.compare_exchange_weak( position, position+1, std::memory_order_relaxed ) ) break;
+		}
+		else if ( difference < 0 ) {
+			return false;
+		}
+		else {
+			position = queue->pushPosition.load( std::memory_order_relaxed );
+		}
+	}
+
+	cell->data = value;
+	cell->sequence.store( position+1, std::memory_order_release );
+	return true;
+}
+
+/////////////////////////////////
+// Returns false if the queue is empty.
+template <typename T>
+inline bool lockfree_queue_pop ( Lockfree_Queue<T> *queue, T *value )
+{
+	typename Lockfree_Queue<T>::Cell *cell;
+	uint32_t position = queue->popPosition.load( std::memory_order_relaxed );
+
+	for ( ;; ) {
+		cell = &queue->cells[ position & queue->mask ];
+		int32_t difference = (int32_t)(cell->sequence.load( std::memory_order_acquire ) - (position+1));
+
+		if ( difference == 0 ) {
+			if ( queue->popPosition.compare_exchange_weak( position, position+1, std::memory_order_relaxed ) ) break;
+		}
+		else if ( difference < 0 ) {
+			return false;
+		}
+		else {
+			position = queue->popPosition.load( std::memory_order_relaxed );
+		}
+	}
+
+	*value = cell->data;
+	cell->sequence.store( position + queue->mask + 1, std::memory_order_release );
+	return true;
+}
+
+
+/////////////////////////////////
+// NOTE(Xavier): (2018.1.8) This is a bounded ring that one thread
+// pushes to & one other thread pops from. Because each position
+// only has one writer no compare exchange is needed, the values
+// are moved in & out of the ring so no memory is allocated once
+// it has been initialised.
+template <typename T>
+struct Spsc_Ring
+{
+	T *cells = nullptr;
+	uint32_t mask = 0;
+
+	uint8_t padding0 [64];
+	std::atomic<uint32_t> popPosition; // Only written by the consumer.
+	uint8_t padding1 [64];
+	std::atomic<uint32_t> pushPosition; // Only written by the producer.
+	uint8_t padding2 [64];
+};
+
+/////////////////////////////////
+template <typename T>
+inline void spsc_ring_init ( Spsc_Ring<T> *ring, uint32_t capacity )
+{
+	uint32_t size = 2;
+	while ( size < capacity ) size <<= 1;
+
+	ring->cells = new T [size];
+	ring->mask = size - 1;
+	ring->popPosition.store( 0, std::memory_order_relaxed );
+	ring->pushPosition.store( 0, std::memory_order_relaxed );
+}
+
+/////////////////////////////////
+template <typename T>
+inline void spsc_ring_free ( Spsc_Ring<T> *ring )
+{
+	delete [] ring->cells;
+	ring->cells = nullptr;
+	ring->mask = 0;
+}
+
+/////////////////////////////////
+// Returns the number of values that can be
+// pushed. Only the producer may rely on it,
+// as the consumer can only make it grow.
+template <typename T>
+inline uint32_t spsc_ring_free_space ( Spsc_Ring<T> *ring )
+{
+	uint32_t used = ring->pushPosition.load( std::memory_order_relaxed ) - ring->popPosition.load( std::memory_order_acquire );
+	return ring->mask + 1 - used;
+}
+
+/////////////////////////////////
+// Returns false if the ring is full,
+// in which case the value is not moved.
+template <typename T>
+inline bool spsc_ring_push ( Spsc_Ring<T> *ring, T&& value )
+{
+	uint32_t position = ring->pushPosition.load( std::memory_order_relaxed );
+	if ( position - ring->popPosition.load( std::memory_order_acquire ) > ring->mask ) return false;
+
+	ring->cells[ position & ring->mask ] = std::move( value );
+	ring->pushPosition.store( position+1, std::memory_order_release );
+	return true;
+}
+
+/////////////////////////////////
+// Returns false if the ring is empty.
+template <typename T>
+inline bool spsc_ring_pop ( Spsc_Ring<T> *ring, T *value )
+{
+	uint32_t position = ring->popPosition.load( std::memory_order_relaxed );
+	if ( position == ring->pushPosition.load( std::memory_order_acquire ) ) return false;
+
+	*value = std::move( ring->cells[ position & ring->mask ] );
+	ring->popPosition.store( position+1, std::memory_order_release );
+	return true;
+}
+
+#endif
@@ -16,6 +16,15 @@
 #include <x86intrin.h>
 #endif
 
+// NOTE(Xavier): (2018.1.6) GCC does not allow members with
+// constructors inside anonymous structs, so the swizzle
+// members ('xy', 'xyz', 'zw') are only available with clang & msvc.
+#if defined(__GNUC__) && !defined(__clang__)
+#define SWIZZLE_SUPPORT 0
+#else
+#define SWIZZLE_SUPPORT 1
+#endif
+
 #include <cstddef>	// For - std::size_t
 #include <cmath>	// For - sin() & cos() & sqrt()
 #include <ostream>	// For - std::ostream
@@ -194,11 +203,13 @@ struct vec3
 		{
 			float elements[3];
 		};
+	#if SWIZZLE_SUPPORT
 		struct
 		{
 			vec2 xy;
 			float _z;
 		};
+	#endif
 	};
 	
 	/////////////////////////////////
@@ -375,6 +386,7 @@ struct vec4
 		{
 			float elements[4];
 		};
+	#if SWIZZLE_SUPPORT
 		struct
 		{
 			vec3 xyz;
@@ -384,6 +396,7 @@ struct vec4
 		{
 			vec2 xy, zw;
 		};
+	#endif
 		#if SSE_SUPPORT
 			__m128 sse;
 		#endif
@@ -448,21 +461,26 @@ struct vec4
 	/////////////////////////////////
 	vec4 ( const vec3& v, const float& w )
 	{
-		this->xyz = v;
+		this->x = v.x;
+		this->y = v.y;
+		this->z = v.z;
 		this->w = w;
 	}
 
 	/////////////////////////////////
 	vec4 ( const vec2& v1, const vec2& v2 )
 	{
-		this->xy = v1;
-		this->zw = v2;
+		this->x = v1.x;
+		this->y = v1.y;
+		this->z = v2.x;
+		this->w = v2.y;
 	}
 
 	/////////////////////////////////
 	vec4 ( const vec2& v, const float& z, const float& w )
 	{
-		this->xy = v;
+		this->x = v.x;
+		this->y = v.y;
 		this->z = z;
 		this->w = w;
 	}
@@ -824,7 +842,9 @@ inline mat4 translate ( const mat4& m, const vec3& dir )
 {
 	mat4 result = m;
 
-	result[3].xyz += dir;
+	result[3].x += dir.x;
+	result[3].y += dir.y;
+	result[3].z += dir.z;
 
 	return result;
 }
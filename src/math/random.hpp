@@ -0,0 +1,46 @@
+#ifndef _RANDOM_HPP_
+#define _RANDOM_HPP_
+
+#include <cstdint>
+
+/////////////////////////////////
+// NOTE(Xavier): (2018.1.7) This is a small seedable random
+// number generator (xorshift64*). Unlike 'rand()' it has no
+// global state, so each system can own a generator and
+// produce the same sequence for the same seed.
+struct Random
+{
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+};
+
+/////////////////////////////////
+inline void random_seed ( Random *random, uint64_t seed )
+{
+	// The seed is scrambled (splitmix64) so that nearby seeds
+	// produce unrelated sequences, and the state is never zero.
+	uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+	random->state = z != 0 ? z : 0x9E3779B97F4A7C15ull;
+}
+
+/////////////////////////////////
+inline uint32_t random_next ( Random *random )
+{
+	uint64_t x = random->state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	random->state = x;
+	return static_cast<uint32_t>( (x * 0x2545F4914F6CDD1Dull) >> 32 );
+}
+
+/////////////////////////////////
+// Returns a value in the range [0, range).
+inline uint32_t random_range ( Random *random, uint32_t range )
+{
+	return static_cast<uint32_t>( (static_cast<uint64_t>( random_next(random) ) * range) >> 32 );
+}
+
+#endif
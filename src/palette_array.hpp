@@ -0,0 +1,277 @@
+#ifndef _PALETTE_ARRAY_HPP_
+#define _PALETTE_ARRAY_HPP_
+
+#include <cstdint>
+#include <cstring>
+
+/////////////////////////////////
+// NOTE(Xavier): (2018.1.12) A palette array stores a fixed number of
+// values as indices into a palette of the distinct values it holds.
+// The indices are packed 1, 2, 4, 8, 16 or 32 bits at a time into
+// 64 bit words, so an index never straddles two words. An array
+// holding one value uses 0 bits: every index reads the first word,
+// which is zero, so reading does not have to check for it.
+// The palette only grows when a new value is set, values that are no
+// longer used stay in it until the array is compacted.
+// Setting a value that is not in the palette can reallocate the array,
+// so it must not be read by another thread while that can happen.
+//
+// NOTE(Xavier): (2018.1.13) Small palettes are kept inside the array,
+// and the owner can give the array a slot of words to keep its indices
+// in while they fit, so an array with up to 'PALETTE_ARRAY_INLINE_SIZE'
+// values in a big enough slot never allocates. The array points into
+// itself, so it must not be copied.
+const uint32_t PALETTE_ARRAY_INLINE_SIZE = 4;
+
+struct Palette_Array
+{
+	uint32_t *palette = nullptr; // Points to 'inlinePalette' or the heap.
+	uint32_t paletteSize = 0;
+	uint32_t paletteCapacity = 0;
+	uint64_t *words = nullptr; // Points to 'slot' or the heap.
+	uint64_t mask = 0; // The low 'bits' bits set.
+	uint32_t bits = 0;
+	uint32_t count = 0;
+
+	uint64_t *slot = nullptr;
+	uint32_t slotWordCount = 0;
+	uint32_t inlinePalette [PALETTE_ARRAY_INLINE_SIZE];
+};
+
+/////////////////////////////////
+inline uint32_t palette_array_word_count ( uint32_t count, uint32_t bits )
+{
+	return bits == 0 ? 1 : (uint32_t)(((uint64_t)count * bits + 63) / 64);
+}
+
+/////////////////////////////////
+// Returns the number of values a palette
+// indexed with a number of bits can hold.
+inline uint32_t palette_array_capacity ( uint32_t count, uint32_t bits )
+{
+	return bits == 32 ? count+1 : 1u << bits;
+}
+
+/////////////////////////////////
+// This function moves the palette to storage
+// that can hold 'capacity' values.
+inline void palette_array_reserve_palette ( Palette_Array *array, uint32_t capacity )
+{
+	uint32_t *palette;
+	if ( capacity <= PALETTE_ARRAY_INLINE_SIZE ) {
+		capacity = PALETTE_ARRAY_INLINE_SIZE;
+		palette = array->inlinePalette;
+	}
+	else {
+		if ( capacity == array->paletteCapacity ) return;
+		palette = new uint32_t [ capacity ];
+	}
+
+	if ( palette != array->palette ) {
+		if ( array->palette != nullptr ) memcpy( palette, array->palette, array->paletteSize * sizeof(uint32_t) );
+		if ( array->palette != array->inlinePalette ) delete [] array->palette;
+		array->palette = palette;
+	}
+	array->paletteCapacity = capacity;
+}
+
+/////////////////////////////////
+// This function replaces the indices with 'wordCount'
+// words packed with a number of bits. If they fit they
+// are copied to the slot & 'words' is deleted.
+inline void palette_array_store_words ( Palette_Array *array, uint64_t *words, uint32_t wordCount, uint32_t bits )
+{
+	if ( array->words != array->slot ) delete [] array->words;
+
+	if ( wordCount <= array->slotWordCount ) {
+		memcpy( array->slot, words, wordCount * sizeof(uint64_t) );
+		delete [] words;
+		array->words = array->slot;
+	}
+	else {
+		array->words = words;
+	}
+
+	array->mask = bits == 0 ? 0 : (bits == 32 ? 0xFFFFFFFFull : (1ull << bits) - 1);
+	array->bits = bits;
+}
+
+/////////////////////////////////
+// Sets every value to 'value'. The indices are kept in
+// 'slot' while they take at most 'slotWordCount' words.
+inline void palette_array_init ( Palette_Array *array, uint32_t count, uint32_t value, uint64_t *slot = nullptr, uint32_t slotWordCount = 0 )
+{
+	array->palette = nullptr;
+	array->paletteSize = 0;
+	palette_array_reserve_palette( array, 1 );
+	array->palette[0] = value;
+	array->paletteSize = 1;
+
+	array->slot = slot;
+	array->slotWordCount = slot != nullptr ? slotWordCount : 0;
+	array->words = nullptr;
+	palette_array_store_words( array, new uint64_t [1] { 0 }, 1, 0 );
+	array->count = count;
+}
+
+/////////////////////////////////
+inline void palette_array_free ( Palette_Array *array )
+{
+	if ( array->palette != array->inlinePalette ) delete [] array->palette;
+	if ( array->words != array->slot ) delete [] array->words;
+	array->palette = nullptr;
+	array->paletteSize = 0;
+	array->paletteCapacity = 0;
+	array->words = nullptr;
+	array->slot = nullptr;
+	array->slotWordCount = 0;
+	array->mask = 0;
+	array->bits = 0;
+	array->count = 0;
+}
+
+/////////////////////////////////
+inline uint32_t palette_array_get ( const Palette_Array *array, uint32_t index )
+{
+	const uint64_t bit = (uint64_t)index * array->bits;
+	return array->palette[ (array->words[ bit >> 6 ] >> (bit & 63)) & array->mask ];
+}
+
+/////////////////////////////////
+// Returns true if every value is the same.
+inline bool palette_array_is_uniform ( const Palette_Array *array )
+{
+	return array->bits == 0;
+}
+
+/////////////////////////////////
+// Returns the number of bytes the array has
+// allocated, not counting its slot.
+inline uint32_t palette_array_memory ( const Palette_Array *array )
+{
+	uint32_t bytes = 0;
+	if ( array->palette != array->inlinePalette ) bytes += array->paletteCapacity * sizeof(uint32_t);
+	if ( array->words != array->slot ) bytes += palette_array_word_count( array->count, array->bits ) * sizeof(uint64_t);
+	return bytes;
+}
+
+/////////////////////////////////
+// This function packs the indices with a number of bits
+// & gives the palette room for as many values as they
+// can index. 'remap' (if not null) gives the new index
+// of each old one.
+inline void palette_array_repack ( Palette_Array *array, uint32_t bits, const uint32_t *remap )
+{
+	const uint32_t wordCount = palette_array_word_count( array->count, bits );
+	uint64_t *words = new uint64_t [ wordCount ];
+	memset( words, 0, wordCount * sizeof(uint64_t) );
+
+	if ( bits != 0 ) {
+		for ( uint32_t i = 0; i < array->count; ++i ) {
+			const uint64_t oldBit = (uint64_t)i * array->bits;
+			uint64_t index = (array->words[ oldBit >> 6 ] >> (oldBit & 63)) & array->mask;
+			if ( remap != nullptr ) index = remap[ index ];
+			const uint64_t bit = (uint64_t)i * bits;
+			words[ bit >> 6 ] |= index << (bit & 63);
+		}
+	}
+
+	palette_array_reserve_palette( array, palette_array_capacity( array->count, bits ) );
+	palette_array_store_words( array, words, wordCount, bits );
+}
+
+/////////////////////////////////
+// This function removes the values that are no
+// longer used from the palette & packs the indices
+// with as few bits as the palette allows.
+inline void palette_array_compact ( Palette_Array *array )
+{
+	if ( array->bits == 0 ) return;
+
+	uint32_t *remap = new uint32_t [ array->paletteSize ];
+	for ( uint32_t i = 0; i < array->paletteSize; ++i ) remap[i] = 0xFFFFFFFF;
+	for ( uint32_t i = 0; i < array->count; ++i ) {
+		const uint64_t bit = (uint64_t)i * array->bits;
+		remap[ (array->words[ bit >> 6 ] >> (bit & 63)) & array->mask ] = 0;
+	}
+
+	uint32_t used = 0;
+	for ( uint32_t i = 0; i < array->paletteSize; ++i ) {
+		if ( remap[i] == 0 ) { array->palette[ used ] = array->palette[i]; remap[i] = used++; }
+	}
+	array->paletteSize = used;
+
+	uint32_t bits = 0;
+	while ( palette_array_capacity( array->count, bits ) < used ) bits = bits == 0 ? 1 : bits * 2;
+
+	palette_array_repack( array, bits, remap );
+	delete [] remap;
+}
+
+/////////////////////////////////
+// This function replaces every value with
+// the 'count' values at 'values', packed
+// with as few bits as they allow.
+inline void palette_array_assign ( Palette_Array *array, const uint32_t *values )
+{
+	// Find the distinct values:
+	array->paletteSize = 0;
+	uint32_t entry = 0;
+	for ( uint32_t i = 0; i < array->count; ++i ) {
+		if ( entry < array->paletteSize && array->palette[ entry ] == values[i] ) continue;
+
+		entry = 0;
+		while ( entry < array->paletteSize && array->palette[ entry ] != values[i] ) ++entry;
+		if ( entry == array->paletteSize ) {
+			if ( array->paletteSize == array->paletteCapacity ) palette_array_reserve_palette( array, array->paletteCapacity * 2 );
+			array->palette[ array->paletteSize++ ] = values[i];
+		}
+	}
+
+	uint32_t bits = 0;
+	while ( palette_array_capacity( array->count, bits ) < array->paletteSize ) bits = bits == 0 ? 1 : bits * 2;
+	palette_array_reserve_palette( array, palette_array_capacity( array->count, bits ) );
+
+	// Pack their indices, straight into the slot if they fit:
+	const uint32_t wordCount = palette_array_word_count( array->count, bits );
+	if ( array->words != array->slot ) delete [] array->words;
+	array->words = wordCount <= array->slotWordCount ? array->slot : new uint64_t [ wordCount ];
+	memset( array->words, 0, wordCount * sizeof(uint64_t) );
+
+	if ( bits != 0 ) {
+		entry = 0;
+		for ( uint32_t i = 0; i < array->count; ++i ) {
+			if ( array->palette[ entry ] != values[i] ) {
+				entry = 0;
+				while ( array->palette[ entry ] != values[i] ) ++entry;
+			}
+			const uint64_t bit = (uint64_t)i * bits;
+			array->words[ bit >> 6 ] |= (uint64_t)entry << (bit & 63);
+		}
+	}
+
+	array->mask = bits == 0 ? 0 : (bits == 32 ? 0xFFFFFFFFull : (1ull << bits) - 1);
+	array->bits = bits;
+}
+
+/////////////////////////////////
+inline void palette_array_set ( Palette_Array *array, uint32_t index, uint32_t value )
+{
+	uint32_t entry = 0;
+	while ( entry < array->paletteSize && array->palette[ entry ] != value ) ++entry;
+
+	if ( entry == array->paletteSize ) {
+		while ( array->paletteSize == palette_array_capacity( array->count, array->bits ) ) {
+			if ( array->bits == 32 ) palette_array_compact( array );
+			else palette_array_repack( array, array->bits == 0 ? 1 : array->bits * 2, nullptr );
+		}
+		entry = array->paletteSize;
+		array->palette[ array->paletteSize++ ] = value;
+	}
+
+	const uint64_t bit = (uint64_t)index * array->bits;
+	uint64_t& word = array->words[ bit >> 6 ];
+	word = (word & ~(array->mask << (bit & 63))) | ((uint64_t)entry << (bit & 63));
+}
+
+#endif
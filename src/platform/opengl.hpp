@@ -12,6 +12,11 @@
 	#include <GL/gl.h>
 #endif
 
+#ifdef PLATFORM_LINUX
+	#define GL_GLEXT_PROTOTYPES
+	#include <GL/glcorearb.h>
+#endif
+
 #include <iostream>
 
 #ifndef DEBUG
@@ -20,6 +20,13 @@ struct WindowInfo
 ////////////////////////////
 // NOTE(Xavier): (2017.11.15) These are calls the
 // platform layer makes to the crossplatform layer:
+enum class Thread_Layout
+{
+	SHARED, // The simulation ticks are jobs run by the same workers as the meshers.
+	SIMULATION_THREAD, // The simulation ticks on a thread of its own.
+};
+void set_thread_count ( unsigned int threads ); // Before 'init', 0 uses every hardware thread.
+void set_thread_layout ( Thread_Layout layout ); // Before 'init'.
 void init ( const WindowInfo& window );
 void input_and_render ( const WindowInfo& window, InputInfo *input );
 void resize ( const WindowInfo& window );
@@ -0,0 +1,189 @@
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "opengl.hpp"
+#include <signal.h>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <chrono>
+
+#include "platform.h"
+#include "../profiler.hpp"
+
+////////////////////////////
+// NOTE(Xavier): (2018.1.6) This is a headless platform layer.
+// It does not create a window, instead it renders into an
+// offscreen EGL pbuffer so the crossplatform layer can be
+// run (and profiled) on machines without a display.
+static WindowInfo windowInfo;
+static InputInfo inputInfo;
+static volatile sig_atomic_t running;
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLSurface eglSurface = EGL_NO_SURFACE;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+
+//////////////////////////////////
+// This function creates an opengl 3.3
+// core context that is not attached
+// to any window.
+static bool create_headless_context ( int width, int height )
+{
+	// Prefer the surfaceless platform so no display server is required:
+	#ifdef EGL_PLATFORM_SURFACELESS_MESA
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+		if ( getPlatformDisplay ) eglDisplay = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr );
+	#endif
+	if ( eglDisplay == EGL_NO_DISPLAY ) eglDisplay = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+	if ( eglDisplay == EGL_NO_DISPLAY ) return false;
+
+	EGLint major, minor;
+	if ( !eglInitialize( eglDisplay, &major, &minor ) ) return false;
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint configCount = 0;
+	if ( !eglChooseConfig( eglDisplay, configAttribs, &config, 1, &configCount ) || configCount == 0 ) return false;
+
+	const EGLint surfaceAttribs[] = {
+		EGL_WIDTH, width,
+		EGL_HEIGHT, height,
+		EGL_NONE
+	};
+	eglSurface = eglCreatePbufferSurface( eglDisplay, config, surfaceAttribs );
+	if ( eglSurface == EGL_NO_SURFACE ) return false;
+
+	if ( !eglBindAPI( EGL_OPENGL_API ) ) return false;
+
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	eglContext = eglCreateContext( eglDisplay, config, EGL_NO_CONTEXT, contextAttribs );
+	if ( eglContext == EGL_NO_CONTEXT ) return false;
+
+	return eglMakeCurrent( eglDisplay, eglSurface, eglSurface, eglContext );
+}
+
+//////////////////////////////////
+static void destroy_headless_context ()
+{
+	eglMakeCurrent( eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+	if ( eglContext != EGL_NO_CONTEXT ) eglDestroyContext( eglDisplay, eglContext );
+	if ( eglSurface != EGL_NO_SURFACE ) eglDestroySurface( eglDisplay, eglSurface );
+	eglTerminate( eglDisplay );
+}
+
+//////////////////////////////////
+static void clear_input_after_frame ()
+{
+	for ( int i = 0; i < KEY_COUNT; ++i ) {
+		inputInfo.downKeys[i] = false;
+		inputInfo.upKeys[i] = false;
+	}
+	for ( int i = 0; i < MOUSE_BUTTON_COUNT; ++i ) {
+		inputInfo.downMouseButtons[i] = false;
+		inputInfo.upMouseButtons[i] = false;
+	}
+	inputInfo.mouseScrollDeltaX = 0;
+	inputInfo.mouseScrollDeltaY = 0;
+}
+
+//////////////////////////////////
+static void handle_signal ( int )
+{
+	running = false;
+}
+
+////////////////////////////////////////////
+// This function will be called from the
+// multiplatform section of the application
+// when the program wants to quit.
+void close_window ()
+{
+	running = false;
+}
+
+
+//////////////////////////////////
+// Usage: linux [-frames N] [-width W] [-height H] [-threads T] [-simthread] [-game]
+//  -frames N   Number of frames to run before exiting (0 runs until SIGINT).
+//  -threads T  Number of threads to use, including the main thread (0 uses all).
+//  -simthread  Gives the simulation a thread of its own (one of the T threads).
+//  -game       Presses 'space' on the first frame to enter the game scene.
+int main ( int argc, const char *argv[] )
+{
+	int width = 800;
+	int height = 600;
+	unsigned int frameCount = 0;
+	bool enterGame = false;
+
+	for ( int i = 1; i < argc; ++i ) {
+		if ( strcmp( argv[i], "-frames" ) == 0 && i+1 < argc ) frameCount = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-width" ) == 0 && i+1 < argc ) width = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-height" ) == 0 && i+1 < argc ) height = atoi( argv[++i] );
+		else if ( strcmp( argv[i], "-threads" ) == 0 && i+1 < argc ) set_thread_count( atoi( argv[++i] ) );
+		else if ( strcmp( argv[i], "-simthread" ) == 0 ) set_thread_layout( Thread_Layout::SIMULATION_THREAD );
+		else if ( strcmp( argv[i], "-game" ) == 0 ) enterGame = true;
+		else {
+			printf( "Usage: %s [-frames N] [-width W] [-height H] [-threads T] [-simthread] [-game]\n", argv[0] );
+			return 1;
+		}
+	}
+
+	if ( !create_headless_context( width, height ) ) {
+		printf( "ERROR: Failed to create a headless OpenGL context (EGL error: 0x%x)\n", eglGetError() );
+		return 1;
+	}
+
+	signal( SIGINT, handle_signal );
+	signal( SIGTERM, handle_signal );
+
+	inputInfo = {};
+	windowInfo.width = width;
+	windowInfo.height = height;
+	windowInfo.hidpi_width = width;
+	windowInfo.hidpi_height = height;
+	windowInfo.deltaTime = 0;
+	init( windowInfo );
+
+	// NOTE(Xavier): (2018.1.6) Frames are paced to 60hz to
+	// match a vsynced window on the other platforms.
+	const auto frameTime = std::chrono::microseconds( 16667 );
+	auto lastTime = std::chrono::steady_clock::now();
+
+	running = true;
+	for ( unsigned int frame = 0; running && (frameCount == 0 || frame < frameCount); ++frame ) {
+		auto startTime = std::chrono::steady_clock::now();
+		windowInfo.deltaTime = std::chrono::duration<float>( startTime - lastTime ).count();
+		lastTime = startTime;
+
+		if ( frame == 0 && enterGame ) inputInfo.downKeys[ (unsigned int)Key::Key_SPACE ] = true;
+
+		input_and_render( windowInfo, &inputInfo );
+		clear_input_after_frame();
+
+		glFinish(); GLCALL;
+
+		std::this_thread::sleep_until( startTime + frameTime );
+	}
+
+	cleanup( windowInfo );
+	destroy_headless_context();
+
+	// Headless runs are used for profiling, so report the zone timings:
+	printf( "ZONE: MIN/AVG/P99\n%s", Profiler::get_report().c_str() );
+
+	return 0;
+}
@@ -6,100 +6,165 @@
 #include "input.hpp"
 #include "globals.hpp"
 #include "scenemanager.hpp"
+#include "profiler.hpp"
+#include "job_system.hpp"
 
-#ifdef PLATFORM_OSX
-#include <mach/mach_time.h>
-#endif
+
+///////////////////////////////////
+// Thread Topology:
+// NOTE(Xavier): (2018.1.11) 'threadCount' is the number of threads the game
+// keeps busy, including the main thread (0 uses every hardware thread).
+// The main thread renders, the others are the job system's workers, which
+// run the simulation ticks, the water helpers & the meshers. With a single
+// thread there are no workers & the main thread runs the jobs each frame,
+// so there the simulation can not tick faster than the frame rate allows.
+// NOTE(Xavier): (2018.1.14) With 'Thread_Layout::SIMULATION_THREAD' (& at
+// least 2 threads) one of the threads only runs the ticks, so they are never
+// queued behind the meshers. The workers then run the water helpers & the
+// meshers, eg. 3 threads are the main thread, the simulation & one mesher.
+static uint32_t threadCount = 0;
+static Thread_Layout threadLayout = Thread_Layout::SHARED;
+static Job_System *jobSystem = nullptr;
+
+void set_thread_count ( unsigned int threads )
+{
+	threadCount = threads;
+}
+
+void set_thread_layout ( Thread_Layout layout )
+{
+	threadLayout = layout;
+}
 
 
 ///////////////////////////////////
-// Simulation Threaad:
+// Simulation Ticks:
+// NOTE(Xavier): (2018.1.10) The simulation ticks at a fixed rate. When it
+// falls behind the ticks it missed are run back to back, but no more than
+// 'MAX_CATCH_UP_TICKS' at once. The time it still could not catch up on
+// is dropped, so a slow stretch is not followed by a long burst of ticks.
+static const uint32_t MAX_CATCH_UP_TICKS = 4;
+struct Tick_Clock
+{
+	uint64_t nextTickTime = 0;
+	uint64_t rateStartTime = 0;
+	uint32_t rateTicks = 0;
+};
+
+//////////////////////////////////
+// This function runs the ticks that are due
+// and returns the time the next one is due.
+static uint64_t run_due_ticks ( Tick_Clock *clock )
+{
+	const uint64_t tickTime = 1000000 / Scene_Manager::simulationTickRate; // microseconds
+
+	uint64_t now = Profiler::get_time();
+	for ( uint32_t tick = 0; tick < MAX_CATCH_UP_TICKS && now >= clock->nextTickTime; ++tick ) {
+		Scene_Manager::simulate_scene();
+		clock->nextTickTime += tickTime;
+		clock->rateTicks++;
+		now = Profiler::get_time();
+	}
+	if ( now > clock->nextTickTime ) clock->nextTickTime = now;
+
+	if ( now - clock->rateStartTime >= 1000000 ) {
+		Scene_Manager::simulationTicksPerSecond = clock->rateTicks * 1000000.0f / (now - clock->rateStartTime);
+		clock->rateStartTime = now;
+		clock->rateTicks = 0;
+	}
+
+	return clock->nextTickTime;
+}
+
+
+///////////////////////////////////
+// Job Graph:
+// NOTE(Xavier): (2018.1.14) The tick job runs the ticks that are due & adds
+// itself again for the time the next one is due, so the workers keep the
+// simulation at its rate however long the frames take. While the scene is
+// not updating it checks again every tick.
+// The mesh jobs are added by whichever thread signals 'generationWork' (eg.
+// the tick that marks a chunk dirty), one per thread that can run them. They
+// are only added again once the ones last added have finished, so slow work
+// is never queued twice. The last one to finish adds them again if there was
+// a signal since they were added. They stop after 'MESH_JOB_BUDGET' so a tick
+// that becomes due is not stuck behind a long meshing job, & are added again
+// while there is more to mesh.
+static const uint64_t MESH_JOB_BUDGET = 4000; // microseconds
+static Tick_Clock tickClock;
+static std::atomic<uint32_t> meshJobsRunning; // The mesh jobs that have been added & not finished.
+static std::atomic<uint32_t> meshWorkCount; // The 'generationWork' count when the mesh jobs were last added.
+static std::atomic_bool meshWorkLeft;
+
+//////////////////////////////////
+static void tick_job ( void * /*data*/, uint32_t /*thread*/ )
+{
+	uint64_t nextTickTime;
+	if ( Scene_Manager::is_simulation_updating() ) {
+		nextTickTime = run_due_ticks( &tickClock );
+	}
+	else {
+		nextTickTime = Profiler::get_time() + 1000000 / Scene_Manager::simulationTickRate;
+		tickClock.nextTickTime = nextTickTime;
+	}
+	job_system_add_at( jobSystem, nextTickTime, tick_job, nullptr );
+}
+
+static void mesh_job ( void *data, uint32_t thread );
+
+//////////////////////////////////
+// Simulation Thread:
+// The thread sleeps until the next tick is due, while the
+// scene is not updating it checks again every tick.
+static std::thread simulationThread;
 static std::atomic_bool terminateSimulationThread;
 static void simulation_thread_entry ()
 {
-	// NOTE(Xavier): (2017.12.5)
-	// This needs to be made crossplatform.
-	#ifdef PLATFORM_OSX
-		mach_timebase_info_data_t timingInfoSimulation;
-		if ( mach_timebase_info (&timingInfoSimulation) != KERN_SUCCESS )
-			printf ("ERROR: mach_timebase_info failed\n");
-		std::size_t startTime;
-	#endif
-
-	unsigned int simTime = 10;
-
-	std::size_t delta = 0;
 	while ( !terminateSimulationThread ) {
-		#ifdef PLATFORM_OSX
-			startTime = mach_absolute_time();
-		#endif
-		
-		Scene_Manager::simulate_scene();
-	
-		#ifdef PLATFORM_OSX
-			std::size_t endTime = mach_absolute_time();
-			std::size_t elapsedTime = endTime - startTime;
-			delta = (elapsedTime * timingInfoSimulation.numer / timingInfoSimulation.denom) / 1000000;
-			if (delta > simTime) delta = simTime;
-			// NOTE(Xavier): (2017.12.5)
-			// The precission here could be improved to microseconds or better.
-			// Instead of milliseconds.
-		#endif
-
-		std::this_thread::sleep_for( std::chrono::milliseconds(simTime-delta) );
+		uint64_t nextTickTime;
+		if ( Scene_Manager::is_simulation_updating() ) {
+			nextTickTime = run_due_ticks( &tickClock );
+		}
+		else {
+			nextTickTime = Profiler::get_time() + 1000000 / Scene_Manager::simulationTickRate;
+			tickClock.nextTickTime = nextTickTime;
+		}
+
+		const uint64_t now = Profiler::get_time();
+		if ( nextTickTime > now ) std::this_thread::sleep_for( std::chrono::microseconds( nextTickTime-now ) );
 	}
+}
 
-	Scene_Manager::simulationStoppedUpdating = true;
-	
-	#if DEBUG
-		std::cout << "Exited Simulation Thread." << std::endl;
-	#endif
+//////////////////////////////////
+// This function can be called from any thread.
+// NOTE(Xavier): (2018.1.14) The signalling thread increments 'generationWork'
+// before it checks 'meshJobsRunning', & the last mesh job decrements the latter
+// before it reads the former, so one of them always sees the other's write.
+static void add_mesh_jobs ()
+{
+	const uint32_t meshers = job_system_get_thread_count( jobSystem ) > 1 ? job_system_get_thread_count( jobSystem ) - 1 : 1;
+
+	uint32_t running = 0;
+	if ( !meshJobsRunning.compare_exchange_strong( running, meshers ) ) return;
+
+	meshWorkCount = Scene_Manager::generationWork.load();
+	for ( uint32_t i = 0; i < meshers; ++i ) job_system_add( jobSystem, mesh_job, nullptr );
 }
 
-///////////////////////////////////
-// Generation Threaad:
-static std::atomic_bool terminateGenerationThread;
-static void generation_thread_entry ()
+//////////////////////////////////
+static void mesh_job ( void * /*data*/, uint32_t thread )
 {
-	// NOTE(Xavier): (2017.12.5)
-	// This needs to be made crossplatform.
-	#ifdef PLATFORM_OSX
-		mach_timebase_info_data_t timingInfoGeneration;
-		if ( mach_timebase_info (&timingInfoGeneration) != KERN_SUCCESS )
-			printf ("ERROR: mach_timebase_info failed\n");
-		std::size_t startTime;
-	#endif
-
-	unsigned int genTime = 10;
-	bool dontWait = false;
-
-	std::size_t delta = 0;
-	while ( !terminateGenerationThread ) {
-		#ifdef PLATFORM_OSX
-			startTime = mach_absolute_time();
-		#endif
-		
-		if ( Scene_Manager::generate_scene() ) dontWait = true;
-		else dontWait = false;
-	
-		#ifdef PLATFORM_OSX
-			std::size_t endTime = mach_absolute_time();
-			std::size_t elapsedTime = endTime - startTime;
-			delta = (elapsedTime * timingInfoGeneration.numer / timingInfoGeneration.denom) / 1000000;
-			if (delta > genTime) delta = genTime;
-			// NOTE(Xavier): (2017.12.5)
-			// The precission here could be improved to microseconds or better.
-			// Instead of milliseconds.
-		#endif
-		
-		if ( dontWait == false ) std::this_thread::sleep_for( std::chrono::milliseconds(genTime-delta) );
+	const uint64_t startTime = Profiler::get_time();
+	while ( Scene_Manager::generate_scene( thread ) ) {
+		if ( Profiler::get_time() - startTime >= MESH_JOB_BUDGET ) {
+			meshWorkLeft = true;
+			break;
+		}
 	}
 
-	Scene_Manager::generationStoppedUpdating = true;
-	
-	#if DEBUG
-		std::cout << "Exited Generation Thread." << std::endl;
-	#endif
+	if ( --meshJobsRunning == 0 ) {
+		if ( meshWorkLeft.exchange( false ) || Scene_Manager::generationWork.load() != meshWorkCount ) add_mesh_jobs();
+	}
 }
 
 //////////////////////////////
@@ -126,19 +191,35 @@ void init ( const WindowInfo& window )
     
 	Scene_Manager::init( window );
 
-	// Begin the simulation thread:
+	uint32_t threads = threadCount;
+	if ( threads == 0 ) threads = std::thread::hardware_concurrency();
+	if ( threads == 0 ) threads = 1;
+
+	const bool ownSimulationThread = threadLayout == Thread_Layout::SIMULATION_THREAD && threads > 1;
+	const uint32_t workers = ownSimulationThread ? threads-2 : threads-1;
+
+	// Every thread that can run a job is given its own mesher:
+	jobSystem = job_system_create( workers );
+	Scene_Manager::jobSystem = jobSystem;
+	Scene_Manager::generationThreadCount = job_system_get_thread_count( jobSystem );
+	tickClock.nextTickTime = Profiler::get_time();
+	tickClock.rateStartTime = tickClock.nextTickTime;
+	meshJobsRunning = 0;
+	meshWorkLeft = false;
+	Scene_Manager::generationWorkAdded = add_mesh_jobs;
+
 	terminateSimulationThread = false;
-	std::thread simulationThread = std::thread( simulation_thread_entry );
-	simulationThread.detach();
-	
-	terminateGenerationThread = false;
-	std::thread generationThread = std::thread( generation_thread_entry );
-	generationThread.detach();
+	if ( ownSimulationThread ) simulationThread = std::thread( simulation_thread_entry );
+	else job_system_add_at( jobSystem, tickClock.nextTickTime, tick_job, nullptr );
+
+	std::cout << "Threads: " << threads << " (" << workers << " workers" << (ownSimulationThread ? ", 1 simulating" : "") << ")\n";
 }
 
 void input_and_render ( const WindowInfo& window, InputInfo *input )
 {
 	Scene_Manager::input_scene( window, input );
+
+	if ( job_system_get_thread_count( jobSystem ) == 1 ) job_system_help( jobSystem );
 	
 	// NOTE(Xavier): (2017.11.29) This was done to fix the OpenGL error 1286 when
 	// the window is resizing.
@@ -156,6 +237,10 @@ void resize ( const WindowInfo& window )
 void cleanup ( const WindowInfo& window )
 {
 	terminateSimulationThread = true;
-	terminateGenerationThread = true;
+	if ( simulationThread.joinable() ) simulationThread.join();
 	Scene_Manager::exit();
+	job_system_destroy( jobSystem );
+	Scene_Manager::generationWorkAdded = nullptr;
+	jobSystem = nullptr;
+	Scene_Manager::jobSystem = nullptr;
 }
@@ -0,0 +1,120 @@
+#include <chrono>
+#include <mutex>
+#include <algorithm>
+
+#include "profiler.hpp"
+
+static const char *zoneNames [Profiler::ZONE_COUNT] = {
+	"simulate",
+	"process_commands",
+	"simulate_water",
+	"generate",
+	"mesh_scan",
+	"build_floor_mesh",
+	"build_wall_mesh",
+	"build_water_mesh",
+	"upload_mesh",
+	"render_layers",
+	"render_top_layer",
+	"render_composite",
+};
+
+struct Zone_Window
+{
+	std::mutex mutex;
+	uint64_t samples [Profiler::WINDOW_SIZE];
+	uint32_t next = 0;
+	uint32_t count = 0;
+};
+
+static Zone_Window zoneWindows [Profiler::ZONE_COUNT];
+
+
+//////////////////////////////////
+// This function returns the current
+// time of a monotonic clock in microseconds.
+uint64_t Profiler::get_time ()
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::microseconds>( now ).count();
+}
+
+//////////////////////////////////
+// This function adds a sample to
+// the rolling window of a zone.
+// It can be called from any thread.
+void Profiler::record ( Zone zone, uint64_t microseconds )
+{
+	if ( zone >= ZONE_COUNT ) return;
+	Zone_Window& window = zoneWindows[ zone ];
+
+	std::lock_guard<std::mutex> lock( window.mutex );
+	window.samples[ window.next ] = microseconds;
+	window.next = (window.next + 1) % WINDOW_SIZE;
+	if ( window.count < WINDOW_SIZE ) window.count++;
+}
+
+//////////////////////////////////
+// This function returns the min,
+// average & 99th percentile of the
+// samples currently in a zone's window.
+Profiler::Zone_Stats Profiler::get_stats ( Zone zone )
+{
+	Zone_Stats result;
+	if ( zone >= ZONE_COUNT ) return result;
+	Zone_Window& window = zoneWindows[ zone ];
+
+	uint64_t samples [WINDOW_SIZE];
+	uint32_t count;
+	{
+		std::lock_guard<std::mutex> lock( window.mutex );
+		count = window.count;
+		std::copy( window.samples, window.samples + count, samples );
+	}
+	if ( count == 0 ) return result;
+
+	uint64_t total = 0;
+	for ( uint32_t i = 0; i < count; ++i ) total += samples[i];
+
+	uint32_t p99Index = (count * 99) / 100;
+	if ( p99Index >= count ) p99Index = count - 1;
+	std::nth_element( samples, samples + p99Index, samples + count );
+
+	result.count = count;
+	result.min = *std::min_element( samples, samples + count );
+	result.avg = total / count;
+	result.p99 = samples[ p99Index ];
+	return result;
+}
+
+//////////////////////////////////
+const char* Profiler::get_zone_name ( Zone zone )
+{
+	if ( zone >= ZONE_COUNT ) return "unknown";
+	return zoneNames[ zone ];
+}
+
+//////////////////////////////////
+// This function returns a line per zone
+// that has samples: "name: min/avg/p99us".
+std::string Profiler::get_report ()
+{
+	std::string result;
+	for ( uint32_t i = 0; i < ZONE_COUNT; ++i ) {
+		Zone_Stats stats = get_stats( (Zone)i );
+		if ( stats.count == 0 ) continue;
+		result += std::string( zoneNames[i] ) + ": " + std::to_string( stats.min ) + "/" + std::to_string( stats.avg ) + "/" + std::to_string( stats.p99 ) + "us\n";
+	}
+	return result;
+}
+
+//////////////////////////////////
+// This function clears every zone's window.
+void Profiler::reset ()
+{
+	for ( uint32_t i = 0; i < ZONE_COUNT; ++i ) {
+		std::lock_guard<std::mutex> lock( zoneWindows[i].mutex );
+		zoneWindows[i].next = 0;
+		zoneWindows[i].count = 0;
+	}
+}
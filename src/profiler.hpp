@@ -0,0 +1,82 @@
+#ifndef _PROFILER_HPP_
+#define _PROFILER_HPP_
+
+#include <cstdint>
+#include <string>
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+namespace Profiler
+{
+	////////////////////////////
+	// NOTE(Xavier): (2018.1.7) The zones are fixed so that
+	// recording a sample never has to look up a name.
+	// 'zoneNames' in profiler.cpp must be kept in the same order.
+	enum Zone : uint32_t
+	{
+		// Simulation Thread:
+		ZONE_SIMULATE = 0,
+		ZONE_PROCESS_COMMANDS,
+		ZONE_SIMULATE_WATER,
+		ZONE_GENERATE,
+
+		// Generation Thread:
+		ZONE_MESH_SCAN,
+		ZONE_BUILD_FLOOR_MESH,
+		ZONE_BUILD_WALL_MESH,
+		ZONE_BUILD_WATER_MESH,
+
+		// Main Thread:
+		ZONE_UPLOAD_MESH,
+		ZONE_RENDER_LAYERS,
+		ZONE_RENDER_TOP_LAYER,
+		ZONE_RENDER_COMPOSITE,
+
+		ZONE_COUNT
+	};
+
+	// The number of samples kept for each zone:
+	const uint32_t WINDOW_SIZE = 256;
+
+	struct Zone_Stats
+	{
+		uint32_t count = 0;
+		uint64_t min = 0;
+		uint64_t avg = 0;
+		uint64_t p99 = 0;
+	};
+
+	// Returns a monotonic timestamp in microseconds:
+	uint64_t get_time ();
+
+	void record ( Zone zone, uint64_t microseconds );
+	Zone_Stats get_stats ( Zone zone );
+	const char* get_zone_name ( Zone zone );
+	std::string get_report ();
+	void reset ();
+
+	//////////////////////////////////
+	// Records the lifetime of the object
+	// as a sample for the given zone.
+	struct Scoped_Zone
+	{
+		Zone zone;
+		uint64_t startTime;
+
+		Scoped_Zone ( Zone zone ) : zone( zone ), startTime( get_time() ) {}
+		~Scoped_Zone () { record( zone, get_time() - startTime ); }
+	};
+}
+
+#define PROFILE_CONCAT_INNER( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT_INNER( a, b )
+
+#if PROFILER_ENABLED
+#define PROFILE_ZONE( zone ) Profiler::Scoped_Zone PROFILE_CONCAT( profileZone_, __LINE__ ) ( Profiler::zone )
+#else
+#define PROFILE_ZONE( zone )
+#endif
+
+#endif
@@ -27,7 +27,15 @@ Scene *Scene_Manager::activeScene = nullptr;
 std::atomic<bool> Scene_Manager::simulationShouldUpdate;
 std::atomic<bool> Scene_Manager::simulationStoppedUpdating;
 std::atomic<bool> Scene_Manager::generationShouldUpdate;
-std::atomic<bool> Scene_Manager::generationStoppedUpdating;
+std::atomic<uint32_t> Scene_Manager::generationThreadsUpdating;
+uint32_t Scene_Manager::generationThreadCount = 1;
+Job_System *Scene_Manager::jobSystem = nullptr;
+std::atomic<uint32_t> Scene_Manager::simulationTickRate ( 100 );
+std::atomic<uint32_t> Scene_Manager::simulationTickBudget ( 7500 );
+std::atomic<float> Scene_Manager::simulationTicksPerSecond ( 0 );
+std::atomic<uint32_t> Scene_Manager::generationWork ( 0 );
+void (*Scene_Manager::generationWorkAdded)() = nullptr;
+Wake_Event Scene_Manager::threadsStopped;
 
 
 /////////////////////////////////
@@ -38,15 +46,14 @@ void Scene_Manager::init( const WindowInfo& window )
 	mainScene = load_main_scene( window );
 	simulationShouldUpdate = false;
 	generationShouldUpdate = false;
-	simulationStoppedUpdating = false;
-	generationStoppedUpdating = false;
+	simulationStoppedUpdating = true;
+	generationThreadsUpdating = 0;
 }
 
 void Scene_Manager::exit()
 {
 	disable_updating();
-	while ( !simulationStoppedUpdating ); // Wait until the scene is no longer being simulated.
-	while ( !generationStoppedUpdating ); // Wait until the scene is no longer being generated.
+	wait_until_stopped();
 	
 	// Cleanup and release all data:
 	if ( activeScene != nullptr ) delete activeScene;
@@ -91,8 +98,7 @@ void Scene_Manager::input_scene( const WindowInfo& window, InputInfo* input )
 void Scene_Manager::change_scene( SceneType scene, const WindowInfo& window )
 {
 	disable_updating();
-	while ( !simulationStoppedUpdating ); // Wait until the scene is no longer being simulated.
-	while ( !generationStoppedUpdating ); // Wait until the scene is no longer being generated.
+	wait_until_stopped();
 	
 	if ( activeScene != nullptr ) delete activeScene;
 	activeScene = nullptr;
@@ -100,22 +106,36 @@ void Scene_Manager::change_scene( SceneType scene, const WindowInfo& window )
 	if ( scene == SceneType::MainMenu ) { /* Do nothing because the main menu will become active by default */}
 	else if ( scene == SceneType::Game ) {
 		activeScene = load_game_scene( window );
-		simulationShouldUpdate = true;
-		generationShouldUpdate = true;
+		enable_updating();
 	}
 }
 
 bool Scene_Manager::is_simulation_updating () { return simulationShouldUpdate; }
 bool Scene_Manager::is_generation_updating () { return generationShouldUpdate; }
 void Scene_Manager::disable_updating () { simulationShouldUpdate = false; generationShouldUpdate = false; }	
-void Scene_Manager::enable_updating () { simulationShouldUpdate = true; generationShouldUpdate = true; }
+void Scene_Manager::enable_updating ()
+{
+	simulationShouldUpdate = true;
+	generationShouldUpdate = true;
+	signal_generation_work();
+}
+void Scene_Manager::set_update_rate ( const int& rate ) { simulationTickRate = rate > 0 ? rate : 1; }
+void Scene_Manager::set_update_budget ( const int& microseconds ) { simulationTickBudget = microseconds > 0 ? microseconds : 0; }
+void Scene_Manager::signal_generation_work ()
+{
+	generationWork++;
+	if ( generationWorkAdded != nullptr ) generationWorkAdded();
+}
 
 ///////////////////////////////////////
 // Simulation Thread:
 void Scene_Manager::simulate_scene()
 {
+	// NOTE(Xavier): (2018.1.11) 'simulationStoppedUpdating' is cleared before
+	// 'simulationShouldUpdate' is read, and the main thread clears the latter
+	// before reading the former, so they can not both miss the other's write.
+	simulationStoppedUpdating = false;
 	if ( simulationShouldUpdate ) {
-		simulationStoppedUpdating = false;
 		if ( activeScene != nullptr ) { activeScene->simulate(); }
 		else {
 			// NOTE(Xavier): (2017.12.4)
@@ -123,24 +143,41 @@ void Scene_Manager::simulate_scene()
 			// does not need to do anything.
 		}
 	}
-	else {
-		simulationStoppedUpdating = true;
-	}
+	simulationStoppedUpdating = true;
+	if ( !simulationShouldUpdate ) wake_event_signal( &threadsStopped );
 }
 
 ///////////////////////////////////////
 // Generation Thread:
-bool Scene_Manager::generate_scene()
+bool Scene_Manager::generate_scene( uint32_t mesher )
 {
+	// NOTE(Xavier): (2018.1.8) The counter is incremented before
+	// 'generationShouldUpdate' is read, so once the main thread has
+	// disabled updating & seen the counter reach zero no generation
+	// thread can still be inside the scene.
+	generationThreadsUpdating++;
+
+	bool result = false;
 	if ( generationShouldUpdate ) {
-		generationStoppedUpdating = false;
 		if ( activeScene != nullptr ) { 
-			return activeScene->generate();
+			result = activeScene->generate( mesher );
 		}
 	}
-	else {
-		generationStoppedUpdating = true;
-	}
 
-	return false;
-}
\ No newline at end of file
+	if ( --generationThreadsUpdating == 0 && !generationShouldUpdate ) wake_event_signal( &threadsStopped );
+	return result;
+}
+
+
+///////////////////////////////////////
+// This function sleeps until the simulation
+// & generation threads are no longer inside
+// the scene. Updating must already be disabled.
+void Scene_Manager::wait_until_stopped ()
+{
+	for ( ;; ) {
+		uint32_t count = wake_event_count( &threadsStopped );
+		if ( simulationStoppedUpdating && generationThreadsUpdating == 0 ) break;
+		wake_event_wait( &threadsStopped, count );
+	}
+}
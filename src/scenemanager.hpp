@@ -3,6 +3,8 @@
 
 #include <atomic>
 #include "scenes/scene.hpp"
+#include "wake_event.hpp"
+#include "job_system.hpp"
 
 enum class SceneType
 {
@@ -26,7 +28,15 @@ public:
 	static std::atomic<bool> simulationShouldUpdate;
 	static std::atomic<bool> simulationStoppedUpdating;
 	static std::atomic<bool> generationShouldUpdate;
-	static std::atomic<bool> generationStoppedUpdating;
+	static std::atomic<uint32_t> generationThreadsUpdating; // The number of generation threads inside 'generate_scene'.
+	static uint32_t generationThreadCount; // The number of threads that may call 'generate_scene', each with its own index.
+	static Job_System *jobSystem; // Runs the scene's simulation & generation, scenes may add their own jobs to it.
+	static std::atomic<uint32_t> simulationTickRate; // The ticks per second the simulation thread aims for.
+	static std::atomic<uint32_t> simulationTickBudget; // Microseconds of work a scene should do per tick, 0 is unlimited.
+	static std::atomic<float> simulationTicksPerSecond; // The ticks per second achieved over the last second.
+	static std::atomic<uint32_t> generationWork; // Incremented when there may be something new to generate.
+	static void (*generationWorkAdded)(); // Called after 'generationWork' is incremented, the platform layer sets it to schedule the generation.
+	static Wake_Event threadsStopped; // Signalled when a thread stops updating after updating was disabled.
 
 	////////////////////////////////////////////////////////////
 	// Main Thread Methods:
@@ -44,6 +54,8 @@ public:
 	static void disable_updating ();
 	static void enable_updating ();
 	static void set_update_rate ( const int& rate );
+	static void set_update_budget ( const int& microseconds );
+	static void signal_generation_work ();
 
 	////////////////////////////////////////////////////////////
 	// Simulation Thread Methods:
@@ -51,7 +63,10 @@ public:
 
 	////////////////////////////////////////////////////////////
 	// Generation Thread Methods:
-	static bool generate_scene ();
+	static bool generate_scene ( uint32_t mesher );
+
+private:
+	static void wait_until_stopped ();
 
 };
 
@@ -1,6 +1,7 @@
 #ifndef _SCENE_HPP_
 #define _SCENE_HPP_
 
+#include <cstdint>
 #include "../platform/platform.h"
 
 class Scene
@@ -19,7 +20,8 @@ public:
 
 	//////////////////////////////////
 	// Generation Thread Methods:
-	virtual bool generate() = 0;
+	// 'mesher' is the index of the generation thread calling.
+	virtual bool generate( uint32_t mesher ) = 0;
 
 	/////////////////
 	// Destructor:
@@ -4,6 +4,7 @@
 #include "../shader.hpp"
 #include "../scenemanager.hpp"
 #include "../debug.hpp"
+#include "../profiler.hpp"
 
 #include "scene_game.hpp"
 
@@ -68,7 +69,9 @@ void Game_Scene::init( const WindowInfo& window )
 	generatingTextMesh.fontsize = 16;
 	create_text_mesh( "Generating region...", generatingTextMesh, packedGlyphTexture, shader );
 
-	region_init( window, &region, 32, 32, 32, 4, 4, 6 );
+	region_init( window, &region, 32, 32, 32, 4, 4, 6, Scene_Manager::generationThreadCount );
+	region.meshWork = Scene_Manager::signal_generation_work;
+	region.jobSystem = Scene_Manager::jobSystem;
 	region_issue_command( &region, {Region_Command_Type::GENERATE_DATA} );
 }
 
@@ -77,15 +80,19 @@ void Game_Scene::render ( const WindowInfo& window )
 	create_text_mesh( (
 
 		"DT: " + std::to_string(window.deltaTime) + "s" +
-		"\nSDT: " + std::to_string(region.simulationDeltaTime) + "us" +
-		"\nGDT: " + std::to_string(region.generationDeltaTime) + "us" +
 		"\nDIM: " + std::to_string((int)window.hidpi_width) + "x" + std::to_string((int)window.hidpi_height) +
 		"\nS: " + std::to_string(region.projectionScale) + 
 		"\nL: " + std::to_string(region.length) + " W: " + std::to_string(region.width) + " H: " + std::to_string(region.height) +
 		"\nCL: " + std::to_string((int)region.chunkLength) + " CW: " + std::to_string((int)region.chunkWidth) + " CH: " + std::to_string((int)region.chunkHeight) +
 		"\nWBU: " + std::to_string(region.numberOfWaterBeingUpdated) +
+		"\nWS: " + std::to_string(region.numberOfWaterSleeping) +
+		"\nWCO: " + std::to_string(region.numberOfWaterCarriedOver) +
+		"\nTPS: " + std::to_string(Scene_Manager::simulationTicksPerSecond) + "/" + std::to_string(Scene_Manager::simulationTickRate) +
+		"\nMBP: " + std::to_string(region.meshBackpressure) +
+		"\nGEN: " + std::to_string(region.generationTime / 1000) + "ms" +
 		"\n\nVH: " + std::to_string(region.viewHeight) +
-		"\nVD: " + std::to_string(region.viewDepth)
+		"\nVD: " + std::to_string(region.viewDepth) +
+		"\n\nMIN/AVG/P99:\n" + Profiler::get_report()
 		
 		).c_str(), textMesh, packedGlyphTexture, shader );
 
@@ -191,20 +198,33 @@ void Game_Scene::input ( const WindowInfo& window, InputInfo* input )
 
 	if ( get_key_down( input, Key::Key_V ) )
 		region.halfHeight = !region.halfHeight;
+
+	// B builds a stone wall & N digs out the tile under
+	// the centre of the screen, on the top visible layer:
+	int x, y, z;
+	if ( get_key_down( input, Key::Key_B ) && region_get_tile_at_view_center( &region, &x, &y, &z ) ) {
+		region_issue_command( &region, {Region_Command_Type::SET_FLOOR, x, y, z, Floor::FLOOR_STONE} );
+		region_issue_command( &region, {Region_Command_Type::SET_WALL, x, y, z, Wall::WALL_STONE} );
+	}
+	if ( get_key_down( input, Key::Key_N ) && region_get_tile_at_view_center( &region, &x, &y, &z ) ) {
+		region_issue_command( &region, {Region_Command_Type::SET_WALL, x, y, z, Wall::WALL_NONE} );
+		region_issue_command( &region, {Region_Command_Type::SET_FLOOR, x, y, z, Floor::FLOOR_NONE} );
+	}
 }
 
 //////////////////////////////////////
 // Simulation Thread - Methods:
 void Game_Scene::simulate ()
 {
+	region.waterTickBudget = Scene_Manager::simulationTickBudget;
 	region_simulate( &region );
 }
 
 //////////////////////////////////////
 // Generation Thread - Methods:
-bool Game_Scene::generate ()
+bool Game_Scene::generate ( uint32_t mesher )
 {
-	return region_build_new_meshes( &region );
+	return region_build_new_meshes( &region, mesher );
 }
 
 //////////////////////////////////////
@@ -2,13 +2,20 @@
 #define _REGION_HPP_
 
 #include <vector>
+#include <deque>
 #include <mutex>
+#include <atomic>
 #include <cstdint>
 #include "../../platform/platform.h"
 #include "../../platform/opengl.hpp"
 #include "../../math/math.hpp"
+#include "../../math/random.hpp"
+#include "../../lockfree_queue.hpp"
+#include "../../palette_array.hpp"
+#include "../../job_system.hpp"
 
 const uint32_t OCCLUSION_BIT = 0x1 << 31;
+const uint32_t ARENA_ALIGNMENT = 64; // A cache line.
 
 enum Direction : uint32_t
 {
@@ -37,24 +44,42 @@ enum class Region_Command_Type
 	ROTATE_RIGHT = 2,
 	ROTATE_LEFT = 3,
 	ADD_WATER_WAVE = 4,
+	SET_FLOOR = 5, // Sets the floor at (x, y, z) to 'tile'.
+	SET_WALL = 6, // Sets the wall at (x, y, z) to 'tile'.
+	SET_WATER = 7, // Sets the water at (x, y, z) to 'amount' (up to 255).
 };
 
+//////////////////////////////////
+// NOTE(Xavier): (2018.1.8) The payload is not used by every command,
+// it is there so commands that edit the region (eg. place a tile or
+// add an amount of water at a position) can be sent the same way.
 struct Region_Command
 {
 	Region_Command_Type type;
+	int32_t x = 0, y = 0, z = 0;
+	uint32_t tile = 0;
+	uint32_t amount = 0;
 };
 
+//////////////////////////////////
+// NOTE(Xavier): (2018.1.12) The floors & walls of a chunk are stored as
+// palette arrays, most chunks are all air or all stone & take a few bytes.
+// They are written while the region is being generated, which the meshers
+// wait for, & by tile edits, which claim the chunks they change the same way
+// a mesher does (see 'chunksBeingMeshed'). The water changes every tick so
+// it is stored a byte per cell.
 struct Chunk_Data
 {
-	uint32_t *floor = nullptr;
+	Palette_Array floor;
 	uint32_t floorBegin, floorEnd;
 	uint32_t floorNonHiddenBegin, floorNonHiddenEnd;
 
-	uint32_t *wall = nullptr;
+	Palette_Array wall;
 	uint32_t wallBegin, wallEnd;
 	uint32_t wallNonHiddenBegin, wallNonHiddenEnd;
 
 	uint8_t *water = nullptr;
+	uint8_t *waterSnapshot = nullptr; // A copy of 'water' published at the end of a simulation tick.
 	uint32_t waterBegin, waterEnd;
 	uint32_t waterNonHiddenBegin, waterNonHiddenEnd;
 };
@@ -80,6 +105,52 @@ struct Chunk_Mesh_Data
 	std::vector<uint32_t> layeredIndexCount;
 };
 
+struct Water_Chunk
+{
+	std::vector<uint32_t> cells; // The active water in the chunk this tick.
+	std::vector<uint32_t> added; // The water this chunk made active for the next tick.
+	std::vector<uint32_t> changed; // The chunks whose water this chunk changed.
+
+	bool dense = false; // True if the chunk is updated by the dense path this tick.
+	bool carriedOver = false; // True if the tick's budget ran out before the chunk was updated.
+	std::vector<uint8_t> denseLayers; // Per layer of the chunk, non zero if it has active water.
+	std::vector<int16_t> denseGrids; // Scratch memory of the dense path.
+};
+
+struct Mesh_Job
+{
+	uint32_t chunk;
+	uint32_t types; // Chunk_Mesh_Data_Type flags of the meshes to build.
+};
+
+// The water a mesher last copied from the snapshots, so the layered
+// & full water meshes of a chunk are built from a single copy:
+struct Mesher_Water
+{
+	std::vector<uint8_t> water; // The chunk, then the chunk above, then the chunk below.
+	uint32_t chunk = 0;
+	uint32_t version = 1; // The 'waterSnapshotVersion' it was copied at, odd if it holds nothing.
+};
+
+//////////////////////////////////
+// The area of the world that is on the screen,
+// in the same space as the mesh vertices.
+struct View_Rect
+{
+	float left, right;
+	float bottom, top;
+};
+
+//////////////////////////////////
+// NOTE(Xavier): (2018.1.8) Each mesher (generation thread) owns
+// one of these. It pops jobs from the back of its own queue and
+// steals from the front of the other meshers' queues.
+struct Mesh_Work_Queue
+{
+	std::mutex mutex;
+	std::deque<Mesh_Job> jobs;
+};
+
 struct Chunk_Mesh
 {
 	struct Sub_Mesh
@@ -113,47 +184,93 @@ struct Chunk_Mesh
 	Sub_Mesh waterMesh_full;
 };
 
+//////////////////////////////////
+// NOTE(Xavier): (2018.1.13) A neighbourhood is a chunk & the 26 chunks
+// around it, found once so the passes that walk the cells of a chunk can
+// read the cells next to them without finding their chunk every time.
+// Cells are given in the chunk's own coordinates, which can be one step
+// outside of it (-1 or the length of a side) to read a neighbouring chunk.
+struct Region_Neighbourhood
+{
+	Chunk_Data *chunks [27]; // [ (dx+1) + (dy+1)*3 + (dz+1)*9 ], null outside the region.
+	int ox, oy, oz; // The location of the chunk's first cell in the world.
+	uint32_t strideY, strideZ; // The offsets between cells along y & z.
+};
+
 struct Region
 {
 	// SIMULATION THREAD:
-	std::vector<vec4> waterThatNeedsUpdate;
-	std::vector<bool> updatedWaterBitset;
+	std::vector<uint32_t> activeWater; // World indices of the water to update next tick, without duplicates.
+	std::vector<uint32_t> activeWaterUpdating; // The cells being updated this tick.
+	uint16_t *activeWaterStamps = nullptr; // Per world cell, equal to the generation if it is in 'activeWater'.
+	uint16_t activeWaterGeneration = 1;
+	Water_Chunk *waterChunks = nullptr;
+	uint8_t *waterSettledDepth = nullptr; // Per world cell, the depth it had when it was last woken.
+	uint16_t *waterWokenTicks = nullptr; // Per world cell, the low bits of the tick it was last woken.
+	uint8_t *waterAsleep = nullptr; // Per world cell, non zero if it was left out of 'activeWater' to sleep.
+	int32_t *heightMap = nullptr; // Per world column (x + y*worldLength), the height of the terrain set by 'region_generate'.
+	uint32_t waterSleepTicks = 8; // The ticks without being woken after which water sleeps, 0 disables sleeping.
+	float waterDenseFraction = 0.1f; // The fraction of active cells in a chunk's active layers above which they are updated together.
+	uint32_t waterTickBudget = 0; // Microseconds the water may take each tick before the rest is carried over, 0 is unlimited.
+	uint64_t waterTick = 0;
+	uint32_t waterThreadCount = 1; // Read when the region is first generated or simulated, if 'jobSystem' was not given.
+	Job_System *jobSystem = nullptr; // Shared with the rest of the game if given, otherwise created for the water.
+	bool ownsJobSystem = false;
+	uint64_t seed = 0;
+	uint32_t *chunksChangedThisTick = nullptr; // Mesh types changed by this tick, per chunk.
+	std::vector<uint32_t> changedChunks; // The chunks with a non zero entry above.
+	std::vector<Region_Command> deferredEdits; // Tile edits waiting for their chunks to stop being meshed, in order.
+
+	// SIMULATION & GENERATION THREADS:
+	std::atomic<uint32_t> *chunksNeedingMeshUpdate = nullptr; // Chunk_Mesh_Data_Type flags per chunk.
+	Lockfree_Queue<uint32_t> dirtyChunks; // Chunks whose flags above became non zero.
+	std::atomic<uint32_t> waterSnapshotVersion; // Odd while the water snapshots are being written.
+	void (*meshWork)() = nullptr; // Called when the meshers may have new work, if not null.
+	std::atomic_bool *chunksBeingMeshed = nullptr; // Per chunk, true while a mesher or a tile edit is using its tiles.
 
-	// GENERATION THREAD:
-	std::mutex chunksNeedingMeshUpdate_mutex;
-	uint32_t *chunksNeedingMeshUpdate = nullptr;
+	// GENERATION THREADS:
+
+	uint32_t mesherCount = 1;
+	Mesh_Work_Queue *mesherQueues = nullptr;
+	Mesher_Water *mesherWater = nullptr;
 
-	std::atomic<uint32_t> generationNextChunk;
 	std::atomic<uint32_t> ageIncrementerFloor;
 	std::atomic<uint32_t> ageIncrementerWall;
 	std::atomic<uint32_t> ageIncrementerWater;
 
+	// MAIN & GENERATION THREADS:
+	std::mutex viewRect_mutex;
+	View_Rect viewRect; // Published by the main thread every frame.
+
 	// MAIN, SIMULATION & GENERATION THREADS:
 	Chunk_Data *chunks = nullptr;
+	uint8_t *chunkArena = nullptr; // The water & tile slots of every chunk, see 'region_init_data'.
+	size_t chunkArenaSize = 0;
 	uint32_t length, width, height;
 	uint32_t chunkLength, chunkWidth, chunkHeight;
+	bool chunkSizeIsPowerOfTwo; // If true locations are split into chunks with the shifts below.
+	uint32_t chunkLengthShift, chunkWidthShift, chunkHeightShift;
 	uint32_t worldLength, worldWidth, worldHeight;
+	bool worldLayerIsPowerOfTwo; // If true cell indices are split with the shifts below.
+	uint32_t worldLengthShift, worldWidthShift;
 	std::atomic<uint32_t> viewDirection;
 
 	std::atomic_bool simulationPaused;
 	std::atomic_bool chunkDataGenerated;
 	
-	std::mutex chunkMeshData_mutex_1;
-	std::vector<Chunk_Mesh_Data> chunkMeshData_1;
-	std::mutex chunkMeshData_mutex_2;
-	std::vector<Chunk_Mesh_Data> chunkMeshData_2;
-
-	std::mutex commandQue_mutex_1;
-	std::vector<Region_Command> commandQue_1;
-	std::mutex commandQue_mutex_2;
-	std::vector<Region_Command> commandQue_2;
-
-	std::atomic<uint32_t> simulationDeltaTime;
-	std::atomic<uint32_t> generationDeltaTime;
+	Spsc_Ring<Chunk_Mesh_Data> *meshRings = nullptr; // One per mesher, emptied by the main thread.
+	std::atomic<uint32_t> meshBackpressure; // Times a mesher waited for its ring to be emptied.
+
+	Lockfree_Queue<Region_Command> commandQueue; // Pushed by any thread, popped by the simulation thread.
+
 	std::atomic<uint32_t> numberOfWaterBeingUpdated;
+	std::atomic<uint32_t> numberOfWaterSleeping;
+	std::atomic<uint32_t> numberOfDenseWaterChunks; // Chunks updated by the dense path last tick.
+	std::atomic<uint32_t> numberOfWaterCarriedOver; // Active water left for the next tick by the budget.
+	std::atomic<uint64_t> generationTime; // Microseconds the last 'region_generate' took.
 
 	// MAIN THREAD:
-	Chunk_Mesh* chunkMeshes;
+	Chunk_Mesh* chunkMeshes = nullptr;
 
 	uint32_t shader;
 	uint32_t chunkMeshTexture;
@@ -163,6 +280,8 @@ struct Region
 	mat4 camera;
 	int viewHeight;
 	int viewDepth;
+	int publishedViewHeight = -1; // The view height & depth the meshers were last woken for.
+	int publishedViewDepth = -1;
 	bool halfHeight;
 
 	bool cameraMoved = false;
@@ -170,7 +289,10 @@ struct Region
 
 ///////////////////
 // EXTRA THREADS:
-bool region_build_new_meshes ( Region *region );
+bool region_build_new_meshes ( Region *region, uint32_t mesher );
+void build_floor_mesh ( Region *region, uint32_t mesher, uint32_t chunk, bool full );
+void build_wall_mesh ( Region *region, uint32_t mesher, uint32_t chunk, bool full );
+void build_water_mesh ( Region *region, uint32_t mesher, uint32_t chunk, bool full );
 
 ///////////////////////
 // SIMULATION THREAD:
@@ -179,13 +301,144 @@ void region_save ( Region *region );
 void region_load ( Region *region );
 void region_simulate ( Region *region );
 
+///////////////////////////////
+// ANY THREAD (NO OPENGL CONTEXT):
+inline void region_mark_chunk_dirty ( Region *region, uint32_t chunk, uint32_t types, bool wakeMeshers = true );
+inline Chunk_Data* region_locate ( Region *region, int x, int y, int z, uint32_t *index );
+inline uint32_t region_get_chunk_index ( Region *region, int x, int y, int z );
+inline void region_get_location ( Region *region, uint32_t index, int *x, int *y, int *z );
+inline void region_neighbourhood_init ( Region *region, Region_Neighbourhood *neighbourhood, uint32_t chunk );
+inline Chunk_Data* region_neighbourhood_locate ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z, uint32_t *index );
+void region_init_data ( Region *region, uint32_t cl, uint32_t cw, uint32_t ch, uint32_t wl, uint32_t ww, uint32_t wh, uint32_t meshers );
+void region_cleanup_data ( Region *region );
+
 /////////////////
 // MAIN THREAD:
-void region_init ( const WindowInfo& window, Region *region, uint32_t cl, uint32_t cw, uint32_t ch, uint32_t wl, uint32_t ww, uint32_t wh );
+void region_init ( const WindowInfo& window, Region *region, uint32_t cl, uint32_t cw, uint32_t ch, uint32_t wl, uint32_t ww, uint32_t wh, uint32_t meshers );
 void region_cleanup ( Region *region );
 void region_render ( const WindowInfo& window, Region *region );
 void region_resize_viewport ( const WindowInfo& window, Region *region );
 void region_upload_new_meshes ( Region *region );
-void region_issue_command ( Region *region, Region_Command command );
+bool region_issue_command ( Region *region, Region_Command command );
+bool region_get_tile_at_view_center ( Region *region, int *x, int *y, int *z );
+
+
+//////////////////////////////////
+// This function marks meshes of a chunk
+// as needing to be rebuilt. The first time a
+// chunk is marked since it was last taken by a
+// mesher its index is pushed to 'dirtyChunks',
+// so each chunk is in the queue at most once.
+// The meshers are woken unless they are the ones
+// putting back chunks they could not mesh yet.
+inline void region_mark_chunk_dirty ( Region *region, uint32_t chunk, uint32_t types, bool wakeMeshers )
+{
+	std::atomic<uint32_t>& flags = region->chunksNeedingMeshUpdate[ chunk ];
+	if ( (flags.load( std::memory_order_relaxed ) & types) == types ) return;
+
+	if ( flags.fetch_or( types ) == 0 ) {
+		lockfree_queue_push( &region->dirtyChunks, chunk );
+		if ( wakeMeshers && region->meshWork != nullptr ) region->meshWork();
+	}
+}
+
+//////////////////////////////////
+// This function returns the chunk that contains
+// a location & sets 'index' to the location in
+// that chunk, or returns null if the location is
+// outside the region.
+// NOTE(Xavier): (2018.1.13) The water & occlusion loops call this for
+// every neighbour they look at, when every side of the chunks is a power
+// of two (the usual case) the divisions are replaced with shifts & masks.
+inline Chunk_Data* region_locate ( Region *region, int x, int y, int z, uint32_t *index )
+{
+	if ( (uint32_t)x >= region->worldLength || (uint32_t)y >= region->worldWidth || (uint32_t)z >= region->worldHeight ) return nullptr;
+
+	uint32_t cx, cy, cz;
+	if ( region->chunkSizeIsPowerOfTwo ) {
+		cx = (uint32_t)x >> region->chunkLengthShift;
+		cy = (uint32_t)y >> region->chunkWidthShift;
+		cz = (uint32_t)z >> region->chunkHeightShift;
+		*index = ((uint32_t)x & (region->chunkLength-1)) | ((uint32_t)y & (region->chunkWidth-1)) << region->chunkLengthShift | ((uint32_t)z & (region->chunkHeight-1)) << (region->chunkLengthShift + region->chunkWidthShift);
+	}
+	else {
+		cx = x / region->chunkLength;
+		cy = y / region->chunkWidth;
+		cz = z / region->chunkHeight;
+		*index = x % region->chunkLength + y % region->chunkWidth * region->chunkLength + z % region->chunkHeight * region->chunkLength*region->chunkWidth;
+	}
+	return &region->chunks[ cx + cy*region->length + cz*region->length*region->width ];
+}
+
+//////////////////////////////////
+// This function returns the index of
+// the chunk that contains a location.
+inline uint32_t region_get_chunk_index ( Region *region, int x, int y, int z )
+{
+	if ( region->chunkSizeIsPowerOfTwo ) {
+		return ((uint32_t)x >> region->chunkLengthShift) + ((uint32_t)y >> region->chunkWidthShift)*region->length + ((uint32_t)z >> region->chunkHeightShift)*region->length*region->width;
+	}
+	return x/(int)region->chunkLength + y/(int)region->chunkWidth*region->length + z/(int)region->chunkHeight*region->length*region->width;
+}
+
+//////////////////////////////////
+// This function splits the index of a cell
+// in the world into its location.
+inline void region_get_location ( Region *region, uint32_t index, int *x, int *y, int *z )
+{
+	if ( region->worldLayerIsPowerOfTwo ) {
+		*x = index & (region->worldLength-1);
+		*y = (index >> region->worldLengthShift) & (region->worldWidth-1);
+		*z = index >> (region->worldLengthShift + region->worldWidthShift);
+		return;
+	}
+	*x = index % region->worldLength;
+	*y = (index / region->worldLength) % region->worldWidth;
+	*z = index / (region->worldLength*region->worldWidth);
+}
+
+//////////////////////////////////
+// This function finds the chunks
+// around a chunk of the region.
+inline void region_neighbourhood_init ( Region *region, Region_Neighbourhood *neighbourhood, uint32_t chunk )
+{
+	const int x = chunk % region->length;
+	const int y = (chunk / region->length) % region->width;
+	const int z = chunk / (region->length*region->width);
+
+	for ( int dz = -1; dz <= 1; ++dz ) {
+		for ( int dy = -1; dy <= 1; ++dy ) {
+			for ( int dx = -1; dx <= 1; ++dx ) {
+				const bool inside = (uint32_t)(x+dx) < region->length && (uint32_t)(y+dy) < region->width && (uint32_t)(z+dz) < region->height;
+				neighbourhood->chunks[ (dx+1) + (dy+1)*3 + (dz+1)*9 ] = inside ? &region->chunks[ chunk + dx + dy*(int)region->length + dz*(int)(region->length*region->width) ] : nullptr;
+			}
+		}
+	}
+
+	neighbourhood->ox = x * region->chunkLength;
+	neighbourhood->oy = y * region->chunkWidth;
+	neighbourhood->oz = z * region->chunkHeight;
+	neighbourhood->strideY = region->chunkLength;
+	neighbourhood->strideZ = region->chunkLength*region->chunkWidth;
+}
+
+//////////////////////////////////
+// This function returns the chunk of the
+// neighbourhood that holds a cell (null if
+// it is outside the region) & sets 'index'
+// to the cell in that chunk.
+inline Chunk_Data* region_neighbourhood_locate ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z, uint32_t *index )
+{
+	int chunk = 13;
+	if ( x < 0 ) { x += region->chunkLength; chunk -= 1; }
+	else if ( x >= (int)region->chunkLength ) { x -= region->chunkLength; chunk += 1; }
+	if ( y < 0 ) { y += region->chunkWidth; chunk -= 3; }
+	else if ( y >= (int)region->chunkWidth ) { y -= region->chunkWidth; chunk += 3; }
+	if ( z < 0 ) { z += region->chunkHeight; chunk -= 9; }
+	else if ( z >= (int)region->chunkHeight ) { z -= region->chunkHeight; chunk += 9; }
+
+	*index = x + y*neighbourhood->strideY + z*neighbourhood->strideZ;
+	return neighbourhood->chunks[ chunk ];
+}
 
 #endif
\ No newline at end of file
@@ -1,95 +1,230 @@
 
-#ifdef PLATFORM_OSX
-#include <mach/mach_time.h>
-#endif
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include "../../profiler.hpp"
 
 #include "region.hpp"
 
 
-static void build_floor_mesh( Region *region, uint32_t chunk, bool full );
-static void build_wall_mesh( Region *region, uint32_t chunk, bool full );
-static void build_water_mesh( Region *region, uint32_t chunk, bool full );
+static bool pop_mesh_job ( Region *region, uint32_t mesher, Mesh_Job *job );
+static void queue_dirty_chunks ( Region *region, uint32_t mesher );
+static void push_mesh_data ( Region *region, uint32_t mesher, Chunk_Mesh_Data&& meshData );
 
 
 //////////////////////////////////
-// This function will test to see
-// if a chunks mesh needs to be updated.
-// If so it will build the mesh.
-bool region_build_new_meshes ( Region *region )
+// This function will take a chunk from
+// the mesher's queue, or steal one from
+// another mesher. When all the queues are
+// empty it will look for chunks whose mesh
+// needs to be updated and share them between
+// the queues. If a chunk was found it will
+// build the mesh.
+bool region_build_new_meshes ( Region *region, uint32_t mesher )
 {
-	bool didWork = false;
-	if ( region->chunkDataGenerated ) {
-		int chunkToBeUpdated = -1;
-		uint32_t chunkToBeUpdatedInfo = 0;
-		
-		region->chunksNeedingMeshUpdate_mutex.lock();
-		
-			uint32_t ii = region->generationNextChunk;
-			uint32_t counter = 0;
-			while ( counter < region->length*region->width*region->height ) {
-				
-				if ( ii >= region->length*region->width*region->height ) ii = 0;
-
-				if ( region->chunksNeedingMeshUpdate[ii] != 0 ) {
-
-					if ( ii/(region->length*region->width)*region->chunkHeight <= region->viewHeight ) {
-						if ( (int)(ii/(region->length*region->width)*region->chunkHeight + region->chunkHeight-1) > (int)region->viewHeight - (int)region->viewDepth ) {
-
-							region->generationNextChunk = ii + 1;
-							if ( region->generationNextChunk >= region->length*region->width*region->height ) region->generationNextChunk = 0;
-
-							chunkToBeUpdated = ii;
-							chunkToBeUpdatedInfo = region->chunksNeedingMeshUpdate[ii];
-							region->chunksNeedingMeshUpdate[ii] = 0;
-							break;
-
-						}
-					}
-				}
-				
-				ii++;
-				counter++;
-			}
-		
-		region->chunksNeedingMeshUpdate_mutex.unlock();
+	if ( !region->chunkDataGenerated ) return false;
+
+	// A chunk can produce six meshes, if the main thread has not made room
+	// for them yet the mesher waits rather than taking a job it can't hand over:
+	if ( spsc_ring_free_space( &region->meshRings[ mesher ] ) < 6 ) {
+		region->meshBackpressure++;
+		return false;
+	}
+
+	Mesh_Job job;
+	if ( !pop_mesh_job( region, mesher, &job ) ) {
+		queue_dirty_chunks( region, mesher );
+		if ( !pop_mesh_job( region, mesher, &job ) ) return false;
+	}
+
+	// NOTE(Xavier): (2018.1.8) A chunk can be queued again while another
+	// mesher is still building it. Only one mesher may build a chunk at a
+	// time (so the newest mesh always has the newest age), so the chunk
+	// is marked to be updated again instead.
+	// The mesher building it wakes the meshers once it is done.
+	if ( region->chunksBeingMeshed[ job.chunk ].exchange( true ) ) {
+		region_mark_chunk_dirty( region, job.chunk, job.types, false );
+		return false;
+	}
+
+	if ( job.types & Chunk_Mesh_Data_Type::FLOOR ) build_floor_mesh( region, mesher, job.chunk, false );
+	if ( job.types & Chunk_Mesh_Data_Type::WALL ) build_wall_mesh( region, mesher, job.chunk, false );
+	if ( job.types & Chunk_Mesh_Data_Type::WATER ) build_water_mesh( region, mesher, job.chunk, false );
+
+	if ( job.types & Chunk_Mesh_Data_Type::FLOOR ) build_floor_mesh( region, mesher, job.chunk, true );
+	if ( job.types & Chunk_Mesh_Data_Type::WALL ) build_wall_mesh( region, mesher, job.chunk, true );
+	if ( job.types & Chunk_Mesh_Data_Type::WATER ) build_water_mesh( region, mesher, job.chunk, true );
 
-		if ( chunkToBeUpdated != -1 )
-		{
-			if ( chunkToBeUpdatedInfo & Chunk_Mesh_Data_Type::FLOOR ) build_floor_mesh( region, chunkToBeUpdated, false );
-			if ( chunkToBeUpdatedInfo & Chunk_Mesh_Data_Type::WALL ) build_wall_mesh( region, chunkToBeUpdated, false );
-			if ( chunkToBeUpdatedInfo & Chunk_Mesh_Data_Type::WATER ) build_water_mesh( region, chunkToBeUpdated, false );
+	region->chunksBeingMeshed[ job.chunk ] = false;
+	if ( region->chunksNeedingMeshUpdate[ job.chunk ] != 0 && region->meshWork != nullptr ) region->meshWork();
 
-			if ( chunkToBeUpdatedInfo & Chunk_Mesh_Data_Type::FLOOR ) build_floor_mesh( region, chunkToBeUpdated, true );
-			if ( chunkToBeUpdatedInfo & Chunk_Mesh_Data_Type::WALL ) build_wall_mesh( region, chunkToBeUpdated, true );
-			if ( chunkToBeUpdatedInfo & Chunk_Mesh_Data_Type::WATER ) build_water_mesh( region, chunkToBeUpdated, true );
+	return true;
+}
+
+
+//////////////////////////////////
+// This function pops a job from the back
+// of the mesher's own queue, if it is empty
+// a job is stolen from the front of another
+// mesher's queue.
+static bool pop_mesh_job ( Region *region, uint32_t mesher, Mesh_Job *job )
+{
+	for ( uint32_t i = 0; i < region->mesherCount; ++i ) {
+		Mesh_Work_Queue& queue = region->mesherQueues[ (mesher + i) % region->mesherCount ];
+
+		std::lock_guard<std::mutex> lock( queue.mutex );
+		if ( queue.jobs.empty() ) continue;
 
-			didWork = true;
+		if ( i == 0 ) {
+			*job = queue.jobs.back();
+			queue.jobs.pop_back();
 		}
+		else {
+			*job = queue.jobs.front();
+			queue.jobs.pop_front();
+		}
+		return true;
 	}
 
-	// TODO(Xavier): (2017.12.29)
-	// Abstract this away.
-#ifdef PLATFORM_OSX
-	mach_timebase_info_data_t timingInfoSimulation;
-	if ( mach_timebase_info (&timingInfoSimulation) != KERN_SUCCESS )
-		printf ("ERROR: mach_timebase_info failed\n");
-
-	static std::size_t startTime;
-	std::size_t endTime = mach_absolute_time();
-	std::size_t elapsedTime = endTime - startTime;
-	startTime = mach_absolute_time();
-	region->generationDeltaTime = (elapsedTime * timingInfoSimulation.numer / timingInfoSimulation.denom) / 1000;
-#endif
-
-	return didWork;
+	return false;
+}
+
+
+//////////////////////////////////
+// This function returns the area of the
+// screen that a chunk's meshes can cover
+// when viewed from the current direction.
+static View_Rect get_chunk_screen_bounds ( Region *region, uint32_t chunk )
+{
+	const uint32_t cz = chunk/(region->length*region->width);
+	const uint32_t temp = chunk - cz * region->length * region->width;
+	const uint32_t cy = temp / region->length;
+	const uint32_t cx = temp % region->length;
+	const float x0 = cx * region->chunkLength, x1 = x0 + region->chunkLength-1;
+	const float y0 = cy * region->chunkWidth, y1 = y0 + region->chunkWidth-1;
+	const float z0 = cz * region->chunkHeight, z1 = z0 + region->chunkHeight-1;
+	const float wLength = region->length * region->chunkLength;
+	const float wWidth = region->width * region->chunkWidth;
+
+	// The tile position along the builders' 'xDir' (a) & 'yDir' (b):
+	float a0, a1, b0, b1;
+	const uint32_t direction = region->viewDirection;
+	if ( direction == Direction::D_WEST ) { a0 = wWidth-1-y1; a1 = wWidth-1-y0; b0 = x0; b1 = x1; }
+	else if ( direction == Direction::D_SOUTH ) { a0 = wLength-1-x1; a1 = wLength-1-x0; b0 = wWidth-1-y1; b1 = wWidth-1-y0; }
+	else if ( direction == Direction::D_EAST ) { a0 = y0; a1 = y1; b0 = wLength-1-x1; b1 = wLength-1-x0; }
+	else { a0 = x0; a1 = x1; b0 = y0; b1 = y1; }
+
+	// pos = (a*xDir + b*yDir)*27 + (0,30)*z, padded by the size of a tile quad:
+	View_Rect result;
+	result.left = (b0 - a1) * 27 - 27;
+	result.right = (b1 - a0) * 27 + 27;
+	result.bottom = (a0 + b0) * 18 + z0 * 30;
+	result.top = (a1 + b1) * 18 + z1 * 30 + 68;
+	return result;
+}
+
+
+//////////////////////////////////
+// This function takes the chunks from the
+// dirty queue that are inside the view height
+// & depth, and shares them between the
+// meshers' queues.
+// Chunks on the screen are queued closest to
+// the center of the screen first, chunks off
+// the screen are left until there is nothing
+// else to mesh.
+static void queue_dirty_chunks ( Region *region, uint32_t mesher )
+{
+	PROFILE_ZONE( ZONE_MESH_SCAN );
+
+	region->viewRect_mutex.lock();
+	const View_Rect view = region->viewRect;
+	region->viewRect_mutex.unlock();
+	const float viewX = (view.left + view.right) * 0.5f;
+	const float viewY = (view.bottom + view.top) * 0.5f;
+
+	struct Prioritised_Job { Mesh_Job job; float distance; };
+	std::vector<Prioritised_Job> visible;
+	std::vector<Mesh_Job> hidden;
+	std::vector<Mesh_Job> deferred;
+
+	uint32_t chunk;
+	while ( lockfree_queue_pop( &region->dirtyChunks, &chunk ) ) {
+		uint32_t types = region->chunksNeedingMeshUpdate[ chunk ].exchange( 0 );
+		if ( types == 0 ) continue;
+
+		if ( (int)(chunk/(region->length*region->width)*region->chunkHeight) > region->viewHeight ||
+			 (int)(chunk/(region->length*region->width)*region->chunkHeight + region->chunkHeight-1) <= (int)region->viewHeight - (int)region->viewDepth ) {
+			deferred.push_back( { chunk, types } );
+			continue;
+		}
+
+		View_Rect bounds = get_chunk_screen_bounds( region, chunk );
+		if ( bounds.right < view.left || bounds.left > view.right || bounds.top < view.bottom || bounds.bottom > view.top ) {
+			hidden.push_back( { chunk, types } );
+			continue;
+		}
+
+		float dx = (bounds.left + bounds.right) * 0.5f - viewX;
+		float dy = (bounds.bottom + bounds.top) * 0.5f - viewY;
+		visible.push_back( { { chunk, types }, dx*dx + dy*dy } );
+	}
+
+	// When nothing on the screen needs meshing the meshers are idle,
+	// so the chunks off the screen are meshed:
+	if ( !visible.empty() ) deferred.insert( deferred.end(), hidden.begin(), hidden.end() );
+
+	// The chunks that are not meshed now are marked dirty again, once all the
+	// queued chunks have been taken, so this loop can not see them again.
+	// They wait for the view to change, so the meshers are not woken for them:
+	for ( auto& job : deferred ) region_mark_chunk_dirty( region, job.chunk, job.types, false );
+
+	std::vector<Mesh_Job> jobs;
+	if ( !visible.empty() ) {
+		std::sort( visible.begin(), visible.end(), []( const Prioritised_Job& a, const Prioritised_Job& b ) { return a.distance < b.distance; } );
+		jobs.reserve( visible.size() );
+		for ( auto& v : visible ) jobs.push_back( v.job );
+	}
+	else {
+		jobs = std::move( hidden );
+	}
+
+	if ( jobs.empty() ) return;
+
+	// The jobs are dealt out round robin, starting with this mesher's queue.
+	// Meshers pop from the back of their queue, so the closest jobs are kept at the back:
+	for ( uint32_t q = 0; q < region->mesherCount; ++q ) {
+		Mesh_Work_Queue& queue = region->mesherQueues[ (mesher + q) % region->mesherCount ];
+
+		std::lock_guard<std::mutex> lock( queue.mutex );
+		for ( uint32_t j = q; j < jobs.size(); j += region->mesherCount ) {
+			queue.jobs.push_front( jobs[j] );
+		}
+	}
+}
+
+
+//////////////////////////////////
+// This function hands built mesh data to
+// the main thread to be uploaded. If the
+// mesher's ring is full it waits for the
+// main thread rather than dropping the mesh.
+static void push_mesh_data ( Region *region, uint32_t mesher, Chunk_Mesh_Data&& meshData )
+{
+	while ( !spsc_ring_push( &region->meshRings[ mesher ], std::move( meshData ) ) ) {
+		region->meshBackpressure++;
+		std::this_thread::yield();
+	}
 }
 
 
 //////////////////////////////////
 // This function builds the chunk
 // mesh for the floors.
-static void build_floor_mesh( Region *region, uint32_t chunk, bool full )
+void build_floor_mesh( Region *region, uint32_t mesher, uint32_t chunk, bool full )
 {
+	PROFILE_ZONE( ZONE_BUILD_FLOOR_MESH );
+
 	std::vector<float> verts;
 	std::vector<uint32_t> indices;
 	std::vector<uint32_t> indexCount;
@@ -110,14 +245,23 @@ static void build_floor_mesh( Region *region, uint32_t chunk, bool full )
 	vec2 tl { 0, 			1.0f-1.0f/512*68*2 };
 	vec2 br { 1.0f/512*54, 	1.0f-1.0f/512*68 };
 
-	uint32_t *chunkDataFloor = region->chunks[chunk].floor;
+	const Palette_Array *chunkDataFloor = &region->chunks[chunk].floor;
+	uint32_t cellCount = region->chunkLength*region->chunkWidth*region->chunkHeight;
 
-	for ( uint32_t i = 0; i < region->chunkLength*region->chunkWidth*region->chunkHeight; ++i ) {
+	// A chunk made of one kind of floor that is not drawn has nothing to mesh:
+	const uint32_t uniform = palette_array_get( chunkDataFloor, 0 );
+	if ( palette_array_is_uniform( chunkDataFloor ) && ((uniform & 0xFFFFFF) == Floor::FLOOR_NONE || ((uniform & OCCLUSION_BIT) != 0 && !full)) ) {
+		indexCount.assign( region->chunkHeight-1, 0 );
+		cellCount = 0;
+	}
+
+	for ( uint32_t i = 0; i < cellCount; ++i ) {
 		if ( i > 0 && i % (region->chunkLength*region->chunkWidth) == 0 )
 			indexCount.push_back( indices.size() );
 
-		if ( (chunkDataFloor[i] & 0xFFFFFF) != Floor::FLOOR_NONE ) {
-			if ( (chunkDataFloor[i] & OCCLUSION_BIT) != 0 && !full ) continue;
+		const uint32_t floor = palette_array_get( chunkDataFloor, i );
+		if ( (floor & 0xFFFFFF) != Floor::FLOOR_NONE ) {
+			if ( (floor & OCCLUSION_BIT) != 0 && !full ) continue;
 
 			float zz = i / (region->chunkLength*region->chunkWidth);
 			uint32_t iTemp = i - zz * region->chunkLength * region->chunkWidth;
@@ -165,41 +309,26 @@ static void build_floor_mesh( Region *region, uint32_t chunk, bool full )
 
 	indexCount.push_back( indices.size() );
 
-	if ( region->chunkMeshData_mutex_2.try_lock() ) {
-		region->chunkMeshData_2.emplace_back();
-		if ( !full ) region->chunkMeshData_2.back().type = Chunk_Mesh_Data_Type::FLOOR;
-		else region->chunkMeshData_2.back().type = Chunk_Mesh_Data_Type::FLOOR_FULL;
-		region->chunkMeshData_2.back().position = vec3( cx, cy, cz );
-		region->chunkMeshData_2.back().age = ++region->ageIncrementerFloor;
-		region->chunkMeshData_2.back().vertexData = std::move( verts );
-		region->chunkMeshData_2.back().indexData = std::move( indices );
-		region->chunkMeshData_2.back().layeredIndexCount = std::move( indexCount );
-
-		region->chunkMeshData_mutex_2.unlock();
-	}
-	else if ( region->chunkMeshData_mutex_1.try_lock() ) {
-		region->chunkMeshData_1.emplace_back();
-		if ( !full ) region->chunkMeshData_1.back().type = Chunk_Mesh_Data_Type::FLOOR;
-		else region->chunkMeshData_1.back().type = Chunk_Mesh_Data_Type::FLOOR_FULL;
-		region->chunkMeshData_1.back().position = vec3( cx, cy, cz );
-		region->chunkMeshData_1.back().age = ++region->ageIncrementerFloor;
-		region->chunkMeshData_1.back().vertexData = std::move( verts );
-		region->chunkMeshData_1.back().indexData = std::move( indices );
-		region->chunkMeshData_1.back().layeredIndexCount = std::move( indexCount );
-
-		region->chunkMeshData_mutex_1.unlock();
-	}
-	else {
-		std::cout << "ERROR: Couldn't upload.\n";
-	}
+	Chunk_Mesh_Data meshData;
+	if ( !full ) meshData.type = Chunk_Mesh_Data_Type::FLOOR;
+	else meshData.type = Chunk_Mesh_Data_Type::FLOOR_FULL;
+	meshData.position = vec3( cx, cy, cz );
+	meshData.age = ++region->ageIncrementerFloor;
+	meshData.vertexData = std::move( verts );
+	meshData.indexData = std::move( indices );
+	meshData.layeredIndexCount = std::move( indexCount );
+
+	push_mesh_data( region, mesher, std::move( meshData ) );
 }
 
 
 //////////////////////////////////
 // This function builds the chunk
 // mesh for walls.
-static void build_wall_mesh( Region *region, uint32_t chunk, bool full )
+void build_wall_mesh( Region *region, uint32_t mesher, uint32_t chunk, bool full )
 {
+	PROFILE_ZONE( ZONE_BUILD_WALL_MESH );
+
 	std::vector<float> verts;
 	std::vector<uint32_t> indices;
 	std::vector<uint32_t> indexCount;
@@ -220,14 +349,23 @@ static void build_wall_mesh( Region *region, uint32_t chunk, bool full )
 	vec2 tl { 0, 			1.0f-1.0f/512*68 };
 	vec2 br { 1.0f/512*54, 	1.0f };
 
-	uint32_t *chunkDataWall = region->chunks[chunk].wall;
+	const Palette_Array *chunkDataWall = &region->chunks[chunk].wall;
+	uint32_t cellCount = region->chunkLength*region->chunkWidth*region->chunkHeight;
 
-	for ( uint32_t i = 0; i < region->chunkLength*region->chunkWidth*region->chunkHeight; ++i ) {
+	// A chunk made of one kind of wall that is not drawn has nothing to mesh:
+	const uint32_t uniform = palette_array_get( chunkDataWall, 0 );
+	if ( palette_array_is_uniform( chunkDataWall ) && ((uniform & 0xFFFFFF) == Wall::WALL_NONE || ((uniform & OCCLUSION_BIT) != 0 && !full)) ) {
+		indexCount.assign( region->chunkHeight-1, 0 );
+		cellCount = 0;
+	}
+
+	for ( uint32_t i = 0; i < cellCount; ++i ) {
 		if ( i > 0 && i % (region->chunkLength*region->chunkWidth) == 0 )
 			indexCount.push_back( indices.size() );
 
-		if ( (chunkDataWall[i] & 0xFFFFFF) != Wall::WALL_NONE ) {
-			if ( (chunkDataWall[i] & OCCLUSION_BIT) != 0 && !full ) continue;
+		const uint32_t wall = palette_array_get( chunkDataWall, i );
+		if ( (wall & 0xFFFFFF) != Wall::WALL_NONE ) {
+			if ( (wall & OCCLUSION_BIT) != 0 && !full ) continue;
 
 			float zz = i / (region->chunkLength*region->chunkWidth);
 			uint32_t iTemp = i - zz * region->chunkLength * region->chunkWidth;
@@ -275,33 +413,16 @@ static void build_wall_mesh( Region *region, uint32_t chunk, bool full )
 
 	indexCount.push_back( indices.size() );
 
-	if ( region->chunkMeshData_mutex_2.try_lock() ) {
-		region->chunkMeshData_2.emplace_back();
-		if ( !full ) region->chunkMeshData_2.back().type = Chunk_Mesh_Data_Type::WALL;
-		else region->chunkMeshData_2.back().type = Chunk_Mesh_Data_Type::WALL_FULL;
-		region->chunkMeshData_2.back().position = vec3( cx, cy, cz );
-		region->chunkMeshData_2.back().age = ++region->ageIncrementerWall;
-		region->chunkMeshData_2.back().vertexData = std::move( verts );
-		region->chunkMeshData_2.back().indexData = std::move( indices );
-		region->chunkMeshData_2.back().layeredIndexCount = std::move( indexCount );
-
-		region->chunkMeshData_mutex_2.unlock();
-	}
-	else if ( region->chunkMeshData_mutex_1.try_lock() ) {
-		region->chunkMeshData_1.emplace_back();
-		if ( !full ) region->chunkMeshData_1.back().type = Chunk_Mesh_Data_Type::WALL;
-		else region->chunkMeshData_1.back().type = Chunk_Mesh_Data_Type::WALL_FULL;
-		region->chunkMeshData_1.back().position = vec3( cx, cy, cz );
-		region->chunkMeshData_1.back().age = ++region->ageIncrementerWall;
-		region->chunkMeshData_1.back().vertexData = std::move( verts );
-		region->chunkMeshData_1.back().indexData = std::move( indices );
-		region->chunkMeshData_1.back().layeredIndexCount = std::move( indexCount );
-
-		region->chunkMeshData_mutex_1.unlock();
-	}
-	else {
-		std::cout << "ERROR: Couldn't upload.\n";
-	}
+	Chunk_Mesh_Data meshData;
+	if ( !full ) meshData.type = Chunk_Mesh_Data_Type::WALL;
+	else meshData.type = Chunk_Mesh_Data_Type::WALL_FULL;
+	meshData.position = vec3( cx, cy, cz );
+	meshData.age = ++region->ageIncrementerWall;
+	meshData.vertexData = std::move( verts );
+	meshData.indexData = std::move( indices );
+	meshData.layeredIndexCount = std::move( indexCount );
+
+	push_mesh_data( region, mesher, std::move( meshData ) );
 }
 
 
@@ -310,23 +431,34 @@ static void build_wall_mesh( Region *region, uint32_t chunk, bool full )
 // at the specified loaction.
 inline Chunk_Data* region_get_chunk ( Region *region, int x, int y, int z )
 {
-	if ( x < 0 || x >= region->length || y < 0 || y >= region->width || z < 0 || z >= region->height ) return nullptr;
+	if ( x < 0 || x >= (int)region->length || y < 0 || y >= (int)region->width || z < 0 || z >= (int)region->height ) return nullptr;
 	return &region->chunks[ x + y*region->length + z*region->length*region->width ];
 }
 
 //////////////////////////////////
-// This function returns the value
-// of water at a loaction.
-inline uint32_t region_get_water ( Region *region, int x, int y, int z )
+// This function copies the published water of
+// a chunk & the chunks above & below it. The
+// copies are all from the same simulation tick,
+// whose snapshot version is returned.
+// Chunks outside the region are copied as empty.
+static uint32_t read_water_snapshot ( Region *region, uint32_t chunk, uint8_t *water, uint8_t *waterAbove, uint8_t *waterBelow )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return 0;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	return region_get_chunk( region, cx, cy, cz )->water[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ];
+	const uint32_t chunkSize = region->chunkLength*region->chunkWidth*region->chunkHeight;
+	const uint32_t layerOfChunks = region->length*region->width;
+
+	for ( ;; ) {
+		uint32_t version = region->waterSnapshotVersion.load( std::memory_order_acquire );
+		if ( version & 1 ) { std::this_thread::yield(); continue; }
+
+		memcpy( water, region->chunks[ chunk ].waterSnapshot, chunkSize );
+		if ( chunk + layerOfChunks < layerOfChunks*region->height ) memcpy( waterAbove, region->chunks[ chunk + layerOfChunks ].waterSnapshot, chunkSize );
+		else memset( waterAbove, 0, chunkSize );
+		if ( chunk >= layerOfChunks ) memcpy( waterBelow, region->chunks[ chunk - layerOfChunks ].waterSnapshot, chunkSize );
+		else memset( waterBelow, 0, chunkSize );
+
+		std::atomic_thread_fence( std::memory_order_acquire );
+		if ( region->waterSnapshotVersion.load( std::memory_order_relaxed ) == version ) return version;
+	}
 }
 
 //////////////////////////////////
@@ -334,22 +466,19 @@ inline uint32_t region_get_water ( Region *region, int x, int y, int z )
 // of a floor at a location.
 inline uint32_t region_get_floor ( Region *region, int x, int y, int z )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return 0;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	return region_get_chunk( region, cx, cy, cz )->floor[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ];
+	uint32_t index;
+	Chunk_Data *chunk = region_locate( region, x, y, z, &index );
+	return chunk != nullptr ? palette_array_get( &chunk->floor, index ) : 0;
 }
 
 
 //////////////////////////////////
 // This function builds the chunk
 // mesh for water.
-static void build_water_mesh( Region *region, uint32_t chunk, bool full )
+void build_water_mesh( Region *region, uint32_t mesher, uint32_t chunk, bool full )
 {
+	PROFILE_ZONE( ZONE_BUILD_WATER_MESH );
+
 	std::vector<float> verts;
 	std::vector<uint32_t> indices;
 	std::vector<uint32_t> indexCount;
@@ -370,7 +499,23 @@ static void build_water_mesh( Region *region, uint32_t chunk, bool full )
 	const vec2 wtl = { 0, 			1.0f-1.0f/512*68*4 };
 	const vec2 wbr = { 1.0f/512*54,	1.0f-1.0f/512*68*3 };
 
-	uint8_t *chunkDataWater = region->chunks[chunk].water;
+	const uint32_t layerSize = region->chunkLength*region->chunkWidth;
+	const uint32_t chunkSize = layerSize*region->chunkHeight;
+
+	// NOTE(Xavier): (2018.1.9) The simulation thread is writing 'water'
+	// while this runs, so the mesh is built from the copy it published
+	// at the end of its last tick.
+	// NOTE(Xavier): (2018.1.14) The copy is kept in the mesher's buffer, the
+	// second mesh of the chunk reuses it unless a newer tick was published.
+	Mesher_Water& snapshot = region->mesherWater[ mesher ];
+	if ( snapshot.chunk != chunk || snapshot.version != region->waterSnapshotVersion.load( std::memory_order_acquire ) ) {
+		snapshot.water.resize( chunkSize*3 );
+		snapshot.version = read_water_snapshot( region, chunk, &snapshot.water[0], &snapshot.water[chunkSize], &snapshot.water[chunkSize*2] );
+		snapshot.chunk = chunk;
+	}
+	const uint8_t *chunkDataWater = &snapshot.water[0];
+	const uint8_t *waterAbove = &snapshot.water[chunkSize];
+	const uint8_t *waterBelow = &snapshot.water[chunkSize*2];
 
 	for ( uint32_t i = 0; i < region->chunkLength*region->chunkWidth*region->chunkHeight; ++i ) {
 		if ( i > 0 && i % (region->chunkLength*region->chunkWidth) == 0 )
@@ -389,7 +534,7 @@ static void build_water_mesh( Region *region, uint32_t chunk, bool full )
 					}
 				}
 				else {
-					if ( region_get_water(region, xx+ox, yy+oy, zz+oz+1) > 0 ) {
+					if ( waterAbove[ i + layerSize - chunkSize ] > 0 ) {
 						continue;
 					}
 				}
@@ -449,7 +594,7 @@ static void build_water_mesh( Region *region, uint32_t chunk, bool full )
 			};
 			verts.insert( verts.end(), tempVerts, tempVerts+20 );
 
-			if ( (region_get_floor(region, xx+ox, yy+oy, zz+oz) & 0xFFFFFF) == Floor::FLOOR_NONE && region_get_water(region, xx+ox, yy+oy, zz+oz-1 ) > 0 ) {
+			if ( (region_get_floor(region, xx+ox, yy+oy, zz+oz) & 0xFFFFFF) == Floor::FLOOR_NONE && (i >= layerSize ? chunkDataWater[ i - layerSize ] : waterBelow[ i + chunkSize - layerSize ]) > 0 ) {
 				zPos -= 0.1f;
 
 				uint32_t idxP = verts.size()/5;
@@ -472,31 +617,14 @@ static void build_water_mesh( Region *region, uint32_t chunk, bool full )
 
 	indexCount.push_back( indices.size() );
 
-	if ( region->chunkMeshData_mutex_2.try_lock() ) {
-		region->chunkMeshData_2.emplace_back();
-		if ( !full ) region->chunkMeshData_2.back().type = Chunk_Mesh_Data_Type::WATER;
-		else region->chunkMeshData_2.back().type = Chunk_Mesh_Data_Type::WATER_FULL;
-		region->chunkMeshData_2.back().position = vec3( cx, cy, cz );
-		region->chunkMeshData_2.back().age = ++region->ageIncrementerWater;
-		region->chunkMeshData_2.back().vertexData = std::move( verts );
-		region->chunkMeshData_2.back().indexData = std::move( indices );
-		region->chunkMeshData_2.back().layeredIndexCount = std::move( indexCount );
-
-		region->chunkMeshData_mutex_2.unlock();
-	}
-	else if ( region->chunkMeshData_mutex_1.try_lock() ) {
-		region->chunkMeshData_1.emplace_back();
-		if ( !full ) region->chunkMeshData_1.back().type = Chunk_Mesh_Data_Type::WATER;
-		else region->chunkMeshData_1.back().type = Chunk_Mesh_Data_Type::WATER_FULL;
-		region->chunkMeshData_1.back().position = vec3( cx, cy, cz );
-		region->chunkMeshData_1.back().age = ++region->ageIncrementerWater;
-		region->chunkMeshData_1.back().vertexData = std::move( verts );
-		region->chunkMeshData_1.back().indexData = std::move( indices );
-		region->chunkMeshData_1.back().layeredIndexCount = std::move( indexCount );
-
-		region->chunkMeshData_mutex_1.unlock();
-	}
-	else {
-		std::cout << "ERROR: Couldn't upload.\n";
-	}
+	Chunk_Mesh_Data meshData;
+	if ( !full ) meshData.type = Chunk_Mesh_Data_Type::WATER;
+	else meshData.type = Chunk_Mesh_Data_Type::WATER_FULL;
+	meshData.position = vec3( cx, cy, cz );
+	meshData.age = ++region->ageIncrementerWater;
+	meshData.vertexData = std::move( verts );
+	meshData.indexData = std::move( indices );
+	meshData.layeredIndexCount = std::move( indexCount );
+
+	push_mesh_data( region, mesher, std::move( meshData ) );
 }
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <memory.h>
 #include "../../shader.hpp"
+#include "../../profiler.hpp"
 
 #include "region.hpp"
 
@@ -17,6 +18,22 @@ static bool framebufferGenerated = false;
 static uint32_t quadVAO = 0, quadVBO = 0;
 static uint32_t framebufferShader = 0;
 
+//////////////////////////////////
+static bool is_power_of_two ( uint32_t value )
+{
+	return value != 0 && (value & (value-1)) == 0;
+}
+
+//////////////////////////////////
+// Returns the number of times
+// 'value' can be halved.
+static uint32_t log2_of ( uint32_t value )
+{
+	uint32_t shift = 0;
+	while ( value > 1 ) { value >>= 1; ++shift; }
+	return shift;
+}
+
 /////////////////////////////////
 // This function will load a texture
 // and return the opengl texture id
@@ -46,14 +63,21 @@ static void load_texture ( uint32_t* texID, const char* name )
 
 //////////////////////////////////
 // This function is responsiable
-// for initilizing everything about
-// the region. This can include
-// information that relates to other threads.
-void region_init ( const WindowInfo& window, Region *region, uint32_t cl, uint32_t cw, uint32_t ch, uint32_t wl, uint32_t ww, uint32_t wh )
+// for initilizing the chunk data and
+// the inter-thread state of the region.
+// It does not require an opengl context.
+void region_init_data ( Region *region, uint32_t cl, uint32_t cw, uint32_t ch, uint32_t wl, uint32_t ww, uint32_t wh, uint32_t meshers )
 {
 	region->chunkLength = cl;
 	region->chunkWidth = cw;
 	region->chunkHeight = ch;
+	region->chunkSizeIsPowerOfTwo = is_power_of_two( cl ) && is_power_of_two( cw ) && is_power_of_two( ch );
+	region->chunkLengthShift = log2_of( cl );
+	region->chunkWidthShift = log2_of( cw );
+	region->chunkHeightShift = log2_of( ch );
+	region->worldLayerIsPowerOfTwo = is_power_of_two( cl*wl ) && is_power_of_two( cw*ww );
+	region->worldLengthShift = log2_of( cl*wl );
+	region->worldWidthShift = log2_of( cw*ww );
 	region->length = wl;
 	region->width = ww;
 	region->height = wh;
@@ -67,30 +91,97 @@ void region_init ( const WindowInfo& window, Region *region, uint32_t cl, uint32
 	region->viewDepth = 72;
 	region->halfHeight = false;
 
+	// Until the main thread publishes a view every chunk is treated as on screen:
+	region->viewRect = { -1e30f, 1e30f, -1e30f, 1e30f };
+
+	// NOTE(Xavier): (2018.1.13) All the chunks are kept in one arena, split into
+	// the water of every chunk, then their snapshots, then slots for the indices
+	// of their floors & walls. Each part is in chunk order, so the neighbours of
+	// a chunk along x are next to it in memory. The tile slots fit indices of up
+	// to 2 bits, a chunk with more kinds of tile than that also uses the heap.
+	// Regenerating the region reuses the same slots.
+	const uint32_t chunkSize = cl*cw*ch;
+	const uint32_t tileSlotWords = palette_array_word_count( chunkSize, 2 );
+	const size_t waterStride = (chunkSize + ARENA_ALIGNMENT-1) & ~(size_t)(ARENA_ALIGNMENT-1);
+	const size_t tileSlotStride = (tileSlotWords*sizeof(uint64_t) + ARENA_ALIGNMENT-1) & ~(size_t)(ARENA_ALIGNMENT-1);
+	region->chunkArenaSize = (waterStride*2 + tileSlotStride*2) * wl*ww*wh;
+	region->chunkArena = new uint8_t [region->chunkArenaSize + ARENA_ALIGNMENT-1];
+	uint8_t *arena = (uint8_t*)(((uintptr_t)region->chunkArena + ARENA_ALIGNMENT-1) & ~(uintptr_t)(ARENA_ALIGNMENT-1));
+	uint8_t *arenaWater = arena;
+	uint8_t *arenaWaterSnapshots = arenaWater + waterStride * wl*ww*wh;
+	uint8_t *arenaFloors = arenaWaterSnapshots + waterStride * wl*ww*wh;
+	uint8_t *arenaWalls = arenaFloors + tileSlotStride * wl*ww*wh;
+	memset( arenaWaterSnapshots, 0, waterStride * wl*ww*wh );
+
 	region->chunks = new Chunk_Data [wl*ww*wh];
-	region->chunksNeedingMeshUpdate = new uint32_t [wl*ww*wh];
-	region->chunkMeshes = new Chunk_Mesh [wl*ww*wh];
+	region->chunksNeedingMeshUpdate = new std::atomic<uint32_t> [wl*ww*wh];
+	region->chunksBeingMeshed = new std::atomic_bool [wl*ww*wh];
+	region->chunksChangedThisTick = new uint32_t [wl*ww*wh];
 	for ( uint32_t i = 0; i < wl*ww*wh; ++i ) {
-		region->chunks[i].floor = new uint32_t [cl*cw*ch];
-		region->chunks[i].wall = new uint32_t [cl*cw*ch];
-		region->chunks[i].water = new uint8_t [cl*cw*ch];
+		palette_array_init( &region->chunks[i].floor, chunkSize, Floor::FLOOR_NONE, (uint64_t*)(arenaFloors + tileSlotStride*i), tileSlotWords );
+		palette_array_init( &region->chunks[i].wall, chunkSize, Wall::WALL_NONE, (uint64_t*)(arenaWalls + tileSlotStride*i), tileSlotWords );
+		region->chunks[i].water = arenaWater + waterStride*i;
+		region->chunks[i].waterSnapshot = arenaWaterSnapshots + waterStride*i;
+		region->chunksNeedingMeshUpdate[i] = 0;
+		region->chunksBeingMeshed[i] = false;
+		region->chunksChangedThisTick[i] = 0;
 	}
 
+	// Each chunk is in the dirty queue at most once, so it never fills:
+	lockfree_queue_init( &region->dirtyChunks, wl*ww*wh );
+	lockfree_queue_init( &region->commandQueue, 1024 );
+	region->waterSnapshotVersion = 0;
+
+	region->mesherCount = meshers > 0 ? meshers : 1;
+	region->mesherQueues = new Mesh_Work_Queue [region->mesherCount];
+	region->mesherWater = new Mesher_Water [region->mesherCount];
+	region->meshRings = new Spsc_Ring<Chunk_Mesh_Data> [region->mesherCount];
+	for ( uint32_t i = 0; i < region->mesherCount; ++i ) spsc_ring_init( &region->meshRings[i], 64 );
+	region->meshBackpressure = 0;
+
 	region->chunkDataGenerated = false;
 	region->simulationPaused = false;
-	region->simulationDeltaTime = 0;
-	region->updatedWaterBitset = std::vector<bool>( region->worldLength*region->worldWidth*region->worldHeight, false );
+	region->numberOfWaterBeingUpdated = 0;
+	region->numberOfWaterSleeping = 0;
+	region->numberOfDenseWaterChunks = 0;
+	region->numberOfWaterCarriedOver = 0;
+	region->generationTime = 0;
+	region->activeWaterStamps = new uint16_t [region->worldLength*region->worldWidth*region->worldHeight];
+	memset( region->activeWaterStamps, 0, region->worldLength*region->worldWidth*region->worldHeight*sizeof(uint16_t) );
+	region->activeWaterGeneration = 1;
+	region->waterChunks = new Water_Chunk [wl*ww*wh];
+	region->waterSettledDepth = new uint8_t [region->worldLength*region->worldWidth*region->worldHeight];
+	memset( region->waterSettledDepth, 0, region->worldLength*region->worldWidth*region->worldHeight );
+	region->waterWokenTicks = new uint16_t [region->worldLength*region->worldWidth*region->worldHeight];
+	memset( region->waterWokenTicks, 0, region->worldLength*region->worldWidth*region->worldHeight*sizeof(uint16_t) );
+	region->waterAsleep = new uint8_t [region->worldLength*region->worldWidth*region->worldHeight];
+	memset( region->waterAsleep, 0, region->worldLength*region->worldWidth*region->worldHeight );
+	region->heightMap = new int32_t [region->worldLength*region->worldWidth];
+	memset( region->heightMap, 0, region->worldLength*region->worldWidth*sizeof(int32_t) );
+	region->waterTick = 0;
+	region->waterThreadCount = 1;
+	region->jobSystem = nullptr;
+	region->ownsJobSystem = false;
 
-	region->chunksNeedingMeshUpdate_mutex.lock();
-		for ( uint32_t i = 0; i < wl*ww*wh; ++i ) {
-			region->chunksNeedingMeshUpdate[i] = Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER;
-		}
-	region->chunksNeedingMeshUpdate_mutex.unlock();
+	for ( uint32_t i = 0; i < wl*ww*wh; ++i ) {
+		region_mark_chunk_dirty( region, i, Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER );
+	}
 
 	region->ageIncrementerFloor = 0;
 	region->ageIncrementerWall = 0;
 	region->ageIncrementerWater = 0;
-	region->generationNextChunk = 0;
+}
+
+//////////////////////////////////
+// This function is responsiable
+// for initilizing everything about
+// the region. This can include
+// information that relates to other threads.
+void region_init ( const WindowInfo& window, Region *region, uint32_t cl, uint32_t cw, uint32_t ch, uint32_t wl, uint32_t ww, uint32_t wh, uint32_t meshers )
+{
+	region_init_data( region, cl, cw, ch, wl, ww, wh, meshers );
+
+	region->chunkMeshes = new Chunk_Mesh [wl*ww*wh];
 
 	region->shader = load_shader(
 		R"(
@@ -137,22 +228,62 @@ void region_init ( const WindowInfo& window, Region *region, uint32_t cl, uint32
 }
 
 //////////////////////////////////
-// This function is responsiable 
-// for cleaning up when the region
-// is removed.
-void region_cleanup ( Region *region )
+// This function releases the chunk
+// data allocated by 'region_init_data'.
+void region_cleanup_data ( Region *region )
 {
 	region->simulationPaused = true;
 	region->chunkDataGenerated = false;
 
 	for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
-		delete [] region->chunks[i].floor;
-		delete [] region->chunks[i].wall;
-		delete [] region->chunks[i].water;
+		palette_array_free( &region->chunks[i].floor );
+		palette_array_free( &region->chunks[i].wall );
 	}
 	delete [] region->chunks;
+	delete [] region->chunkArena;
 	delete [] region->chunksNeedingMeshUpdate;
+	delete [] region->chunksBeingMeshed;
+	delete [] region->chunksChangedThisTick;
+	delete [] region->activeWaterStamps;
+	delete [] region->waterChunks;
+	delete [] region->waterSettledDepth;
+	delete [] region->waterWokenTicks;
+	delete [] region->waterAsleep;
+	delete [] region->heightMap;
+	if ( region->ownsJobSystem ) job_system_destroy( region->jobSystem );
+	delete [] region->mesherQueues;
+	delete [] region->mesherWater;
+	for ( uint32_t i = 0; i < region->mesherCount; ++i ) spsc_ring_free( &region->meshRings[i] );
+	delete [] region->meshRings;
+	lockfree_queue_free( &region->dirtyChunks );
+	lockfree_queue_free( &region->commandQueue );
+	region->chunks = nullptr;
+	region->chunkArena = nullptr;
+	region->chunksNeedingMeshUpdate = nullptr;
+	region->chunksBeingMeshed = nullptr;
+	region->chunksChangedThisTick = nullptr;
+	region->activeWaterStamps = nullptr;
+	region->waterChunks = nullptr;
+	region->waterSettledDepth = nullptr;
+	region->waterWokenTicks = nullptr;
+	region->waterAsleep = nullptr;
+	region->heightMap = nullptr;
+	region->jobSystem = nullptr;
+	region->ownsJobSystem = false;
+	region->mesherQueues = nullptr;
+	region->mesherWater = nullptr;
+	region->meshRings = nullptr;
+}
+
+//////////////////////////////////
+// This function is responsiable 
+// for cleaning up when the region
+// is removed.
+void region_cleanup ( Region *region )
+{
+	region_cleanup_data( region );
 	delete [] region->chunkMeshes;
+	region->chunkMeshes = nullptr;
 
 	glDeleteFramebuffers( 1, &framebuffer );
 	glDeleteTextures( 1, &texColorBuffer );
@@ -163,6 +294,36 @@ void region_cleanup ( Region *region )
 	framebufferGenerated = false;
 }
 
+//////////////////////////////////
+// This function gives the meshers the
+// area of the world that the camera can
+// see, so they can mesh it first.
+// If it changed the meshers are woken, as
+// chunks they put off may now be in view.
+static void publish_view_rect ( const WindowInfo& window, Region *region )
+{
+	const float halfWidth = window.width/2*region->projectionScale;
+	const float halfHeight = window.height/2*region->projectionScale;
+	const float centerX = -region->camera[3].x;
+	const float centerY = -region->camera[3].y;
+	const View_Rect view = { centerX-halfWidth, centerX+halfWidth, centerY-halfHeight, centerY+halfHeight };
+
+	// Only this thread writes the rect, so it can be read without the lock:
+	const View_Rect& old = region->viewRect;
+	bool changed = view.left != old.left || view.right != old.right || view.bottom != old.bottom || view.top != old.top ||
+				   region->viewHeight != region->publishedViewHeight || region->viewDepth != region->publishedViewDepth;
+	if ( !changed ) return;
+
+	region->viewRect_mutex.lock();
+	region->viewRect = view;
+	region->viewRect_mutex.unlock();
+	region->publishedViewHeight = region->viewHeight;
+	region->publishedViewDepth = region->viewDepth;
+
+	if ( region->meshWork != nullptr ) region->meshWork();
+}
+
+
 //////////////////////////////////
 // This function uploads then
 // renders the regions meshes.
@@ -184,6 +345,7 @@ void region_render ( const WindowInfo& window, Region *region )
 	glClearColor( 0.5f, 0.6f, 0.7f, 1.0f ); GLCALL;
 
 	region_upload_new_meshes( region );
+	publish_view_rect( window, region );
 
 	if ( region->viewHeight < 0 ) region->viewHeight = 0;
 	if ( region->viewHeight > region->worldHeight-1 ) region->viewHeight = region->worldHeight-1;
@@ -196,6 +358,8 @@ void region_render ( const WindowInfo& window, Region *region )
 	set_uniform_mat4( region->shader, "projection", &region->projection );
 	set_uniform_mat4( region->shader, "view", &region->camera );
 	
+	uint64_t passStartTime = Profiler::get_time();
+
 	int viewHeightMinOne = (int)region->viewHeight - 1;
 	for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
 		if ( (int)(i/(region->length*region->width)*region->chunkHeight) > viewHeightMinOne ) continue;
@@ -293,6 +457,9 @@ void region_render ( const WindowInfo& window, Region *region )
 		}
 	}
 
+	Profiler::record( Profiler::ZONE_RENDER_LAYERS, Profiler::get_time() - passStartTime );
+	passStartTime = Profiler::get_time();
+
 	uint32_t regionTexture = region->chunkMeshTexture;
 	if ( region->halfHeight ) regionTexture = region->chunkMeshTexture_halfHeight;
 	for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
@@ -383,6 +550,9 @@ void region_render ( const WindowInfo& window, Region *region )
 		}
 
 	}
+
+	Profiler::record( Profiler::ZONE_RENDER_TOP_LAYER, Profiler::get_time() - passStartTime );
+	passStartTime = Profiler::get_time();
 	
 	glUseProgram( framebufferShader ); GLCALL;
 		uint32_t colorLocation = glGetUniformLocation(framebufferShader, "colorTexture");
@@ -399,6 +569,8 @@ void region_render ( const WindowInfo& window, Region *region )
 	    glBindVertexArray( 0 ); GLCALL;
     glUseProgram( 0 ); GLCALL;
 
+	Profiler::record( Profiler::ZONE_RENDER_COMPOSITE, Profiler::get_time() - passStartTime );
+
     // region->cameraMoved = false;
 }
 
@@ -524,6 +696,8 @@ void region_resize_viewport ( const WindowInfo& window, Region *region )
 // opengl driver.
 static void upload_mesh ( Region *region, Chunk_Mesh_Data *meshData )
 {
+	PROFILE_ZONE( ZONE_UPLOAD_MESH );
+
 	auto index = static_cast<uint32_t>(meshData->position.x + meshData->position.y*region->length + meshData->position.z*region->length*region->width);
 	auto& cm = region->chunkMeshes[ index ];
 
@@ -730,38 +904,64 @@ static void upload_mesh ( Region *region, Chunk_Mesh_Data *meshData )
 // new meshes to the opengl driver.
 void region_upload_new_meshes ( Region *region )
 {
-	if ( region->chunkMeshData_mutex_1.try_lock() ) {
-		for ( auto& meshData : region->chunkMeshData_1 ) {
-			upload_mesh( region, &meshData );
-		}
-		region->chunkMeshData_1.clear();
-		region->chunkMeshData_mutex_1.unlock();
-	}
-	
-	if ( region->chunkMeshData_mutex_2.try_lock() ) {
-		for ( auto& meshData : region->chunkMeshData_2 ) {
+	bool uploaded = false;
+	Chunk_Mesh_Data meshData;
+	for ( uint32_t i = 0; i < region->mesherCount; ++i ) {
+		while ( spsc_ring_pop( &region->meshRings[i], &meshData ) ) {
 			upload_mesh( region, &meshData );
+			uploaded = true;
 		}
-		region->chunkMeshData_2.clear();
-		region->chunkMeshData_mutex_2.unlock();
 	}
+
+	// A mesher may be waiting for room in its ring:
+	if ( uploaded && region->meshWork != nullptr ) region->meshWork();
 }
 
 //////////////////////////////////
 // This function handles the inter-
 // thread communication and sends a 
 // command to the simulation thread.
-void region_issue_command ( Region *region, Region_Command command )
+// It returns false if the command was dropped.
+bool region_issue_command ( Region *region, Region_Command command )
 {
-	if ( region->commandQue_mutex_1.try_lock() ) {
-		region->commandQue_1.push_back( command );
-		region->commandQue_mutex_1.unlock();
-	}
-	else if ( region->commandQue_mutex_2.try_lock() ) {
-		region->commandQue_2.push_back( command );
-		region->commandQue_mutex_2.unlock();
-	}
-	else {
-		std::cout << "ERROR: Region Command was not able to be issued.\n";
+	// NOTE(Xavier): (2018.1.14) The queue only fills if the simulation has stopped
+	// taking commands. Waiting for room could then never end, eg. with a single
+	// thread the ticks that empty it run on the thread that is waiting.
+	if ( !lockfree_queue_push( &region->commandQueue, command ) ) {
+		std::cout << "ERROR: The region's command queue is full, command " << (int)command.type << " was dropped.\n";
+		return false;
 	}
+	return true;
+}
+
+//////////////////////////////////
+// This function finds the tile on the top layer
+// that is drawn (one below 'viewHeight') under the
+// centre of the screen. It returns false if that
+// is outside the world.
+// NOTE(Xavier): (2018.1.14) A tile is drawn at
+// (b-a)*27, (a+b)*18 + z*30, where a & b are its position along the
+// builders' 'xDir' & 'yDir' (see 'get_chunk_screen_bounds'), so a & b
+// are found from the centre of its top & turned back into x & y.
+bool region_get_tile_at_view_center ( Region *region, int *x, int *y, int *z )
+{
+	const float centerX = -region->camera[3].x;
+	const float centerY = -region->camera[3].y;
+	const int tileZ = region->viewHeight - 1;
+
+	const float across = centerX / 27.0f; // b - a
+	const float along = (centerY - 18.0f - tileZ * 30.0f) / 18.0f; // a + b
+	const int a = (int)floorf( (along - across) * 0.5f + 0.5f );
+	const int b = (int)floorf( (along + across) * 0.5f + 0.5f );
+
+	const int wLength = region->worldLength;
+	const int wWidth = region->worldWidth;
+	const uint32_t direction = region->viewDirection;
+	if ( direction == Direction::D_WEST ) { *x = b; *y = wWidth-1-a; }
+	else if ( direction == Direction::D_SOUTH ) { *x = wLength-1-a; *y = wWidth-1-b; }
+	else if ( direction == Direction::D_EAST ) { *x = wLength-1-b; *y = a; }
+	else { *x = a; *y = b; }
+	*z = tileZ;
+
+	return *x >= 0 && *x < wLength && *y >= 0 && *y < wWidth && *z >= 0 && *z < (int)region->worldHeight;
 }
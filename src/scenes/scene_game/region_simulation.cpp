@@ -1,15 +1,45 @@
 
+#include <algorithm>
+#include <cstring>
+#include <thread>
 #include "../../math/perlin.hpp"
-#ifdef PLATFORM_OSX
-#include <mach/mach_time.h>
-#endif
+#include "../../math/random.hpp"
+#include "../../profiler.hpp"
 
 #include "region.hpp"
 
 
 static void process_commands ( Region *region );
 static float generate_height_data ( float xx, float yy, float scale, int octaves, float persistance, float lacunarity, bool power );
-static void simulate_water ( Region *region, std::vector<uint32_t> &newChunksThatNeedUpdate );
+static void simulate_water ( Region *region );
+static void simulate_water_chunk ( Region *region, uint32_t chunk );
+static void simulate_dense_water_chunk ( Region *region, uint32_t chunk );
+static void move_dense_water_border ( Region *region, uint32_t chunk, int dx, int dy );
+static int fall_water ( Region *region, Water_Chunk *waterChunk, uint32_t chunk, const Region_Neighbourhood *neighbourhood, int x, int y, int z, int sameDepth );
+static void mark_chunk_changed ( Region *region, uint32_t chunk, uint32_t types );
+static void add_active_water ( Region *region, std::vector<uint32_t>& activeWater, int x, int y, int z );
+static void add_active_water_cell ( Region *region, std::vector<uint32_t>& activeWater, uint32_t index );
+static void set_active_water ( Region *region, int x, int y, int z, uint32_t depth );
+static bool is_water_asleep ( Region *region, uint32_t index );
+static void mark_water_changed ( Water_Chunk *waterChunk, uint32_t chunk );
+static void publish_changed_chunks ( Region *region );
+static void get_occlusion ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z, uint32_t *floor, uint32_t *wall );
+static void update_occlusion ( Region *region, int x, int y, int z );
+static bool edit_tile ( Region *region, const Region_Command& command );
+static Job_System* get_job_system ( Region *region );
+static void generate_column_heights ( void *data, uint32_t column );
+static void generate_column_tiles ( void *data, uint32_t column );
+static void generate_column_occlusion ( void *data, uint32_t column );
+static void pack_column_occlusion ( void *data, uint32_t column );
+
+// The state shared by the passes of 'region_generate':
+struct Generation_Pass
+{
+	Region *region;
+	std::vector<std::vector<uint32_t>> columnWater; // The water cells added by each column.
+	std::vector<uint64_t> occlusion; // Per chunk, a bit per floor then a bit per wall, set if it is hidden.
+	uint32_t occlusionWords; // The words of bits per chunk for floors (and for walls).
+};
 
 // HELPER FUNCTIONS:
 inline Chunk_Data* region_get_chunk ( Region *region, int x, int y, int z );
@@ -19,6 +49,9 @@ inline uint32_t region_get_water ( Region *region, int x, int y, int z );
 inline void region_set_floor ( Region *region, int x, int y, int z, uint32_t floor );
 inline void region_set_wall ( Region *region, int x, int y, int z, uint32_t wall );
 inline void region_set_water ( Region *region, int x, int y, int z, uint32_t water );
+inline uint32_t region_neighbourhood_get_floor ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z );
+inline uint32_t region_neighbourhood_get_wall ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z );
+inline uint32_t region_neighbourhood_get_water ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z );
 
 
 //////////////////////////////////
@@ -26,38 +59,162 @@ inline void region_set_water ( Region *region, int x, int y, int z, uint32_t wat
 // for simulating the region.
 void region_simulate ( Region *region )
 {
+	PROFILE_ZONE( ZONE_SIMULATE );
+
 	process_commands( region );
 
 	if ( region->chunkDataGenerated ) {
 		if ( !region->simulationPaused ) {	
 
-			std::vector<uint32_t> newChunksThatNeedUpdate( region->length*region->width*region->height, 0 );
-			
-			simulate_water( region, newChunksThatNeedUpdate );
+			simulate_water( region );
+		}
 
-			region->chunksNeedingMeshUpdate_mutex.lock();
+		publish_changed_chunks( region );
+	}
+}
 
-			for ( uint32_t i = 0; i < newChunksThatNeedUpdate.size(); ++i ) {
-				region->chunksNeedingMeshUpdate[ i ] |= newChunksThatNeedUpdate[ i ];
-			}
 
-			region->chunksNeedingMeshUpdate_mutex.unlock();
+//////////////////////////////////
+// This function adds a cell to the water
+// that will be updated next tick, unless
+// it has already been added this tick.
+static void add_active_water ( Region *region, std::vector<uint32_t>& activeWater, int x, int y, int z )
+{
+	if ( x < 0 || x >= (int)region->worldLength || y < 0 || y >= (int)region->worldWidth || z < 0 || z >= (int)region->worldHeight ) return;
+
+	add_active_water_cell( region, activeWater, x + y*region->worldLength + z*region->worldLength*region->worldWidth );
+}
+
+//////////////////////////////////
+// A sleeping cell that is added is no longer
+// asleep, the end of the tick decides if it
+// goes back to sleep.
+static void add_active_water_cell ( Region *region, std::vector<uint32_t>& activeWater, uint32_t index )
+{
+	if ( region->activeWaterStamps[ index ] == region->activeWaterGeneration ) return;
+	region->activeWaterStamps[ index ] = region->activeWaterGeneration;
+	activeWater.push_back( index );
+
+	if ( region->waterAsleep[ index ] ) {
+		region->waterAsleep[ index ] = 0;
+		region->numberOfWaterSleeping--;
+	}
+}
+
+
+//////////////////////////////////
+// NOTE(Xavier): (2018.1.9) Water that has not been woken for 'waterSleepTicks'
+// ticks, & whose neighbours have not been woken either, goes to sleep. It
+// is not added to the active water again until it or a neighbour is woken.
+// A cell is woken when its depth moves more than this from the depth it
+// had when it was last woken, or when it fills or empties. The dead band
+// stops the cells that only swap the odd unit of water with each other
+// from keeping a whole lake awake.
+static const int WATER_SLEEP_DEAD_BAND = 1;
+
+//////////////////////////////////
+// This function sets the depth of water
+// while it is being simulated, & records
+// if it woke the cell. It is safe to call
+// while other chunks of the phase update.
+static void set_active_water ( Region *region, int x, int y, int z, uint32_t depth )
+{
+	region_set_water( region, x, y, z, depth );
+	if ( region->waterSleepTicks == 0 ) return;
+
+	uint32_t index = x + y*region->worldLength + z*region->worldLength*region->worldWidth;
+	int settled = region->waterSettledDepth[ index ];
+	if ( abs( (int)depth - settled ) > WATER_SLEEP_DEAD_BAND || (depth == 0) != (settled == 0) ) {
+		region->waterSettledDepth[ index ] = depth;
+		region->waterWokenTicks[ index ] = (uint16_t)region->waterTick;
+	}
+}
+
+//////////////////////////////////
+// This function returns true if neither a cell nor the
+// six cells next to it were woken in the last
+// 'waterSleepTicks' ticks (including this one), &
+// the cell is level with the open cells beside it.
+static bool is_water_asleep ( Region *region, uint32_t index )
+{
+	const uint32_t layer = region->worldLength*region->worldWidth;
+	int x, y, z;
+	region_get_location( region, index, &x, &y, &z );
+	const uint16_t tick = (uint16_t)region->waterTick;
+	const uint16_t *woken = region->waterWokenTicks;
+
+	auto recent = [&]( uint32_t i ) { return (uint16_t)(tick - woken[i]) < region->waterSleepTicks; };
+
+	if ( recent( index ) ) return false;
+	if ( x > 0 && recent( index-1 ) ) return false;
+	if ( x+1 < (int)region->worldLength && recent( index+1 ) ) return false;
+	if ( y > 0 && recent( index-region->worldLength ) ) return false;
+	if ( y+1 < (int)region->worldWidth && recent( index+region->worldLength ) ) return false;
+	if ( z > 0 && recent( index-layer ) ) return false;
+	if ( z+1 < (int)region->worldHeight && recent( index+layer ) ) return false;
+
+	// A difference of 2 or more is a slope that has not settled, even if it only moves a unit at a time:
+	const int depth = region_get_water( region, x, y, z );
+	auto slope = [&]( int nx, int ny ) {
+		if ( nx < 0 || nx >= (int)region->worldLength || ny < 0 || ny >= (int)region->worldWidth ) return false;
+		return region_get_wall( region, nx, ny, z ) == Wall::WALL_NONE && abs( (int)region_get_water( region, nx, ny, z ) - depth ) > 1;
+	};
+	if ( slope( x+1, y ) || slope( x-1, y ) || slope( x, y+1 ) || slope( x, y-1 ) ) return false;
+	return true;
+}
+
+
+//////////////////////////////////
+// This function records that a chunk's
+// water mesh needs to be rebuilt, it is
+// safe to call while other chunks update.
+static void mark_water_changed ( Water_Chunk *waterChunk, uint32_t chunk )
+{
+	for ( uint32_t changed : waterChunk->changed ) if ( changed == chunk ) return;
+	waterChunk->changed.push_back( chunk );
+}
+
+
+//////////////////////////////////
+// This function records that a chunk's
+// meshes changed during this tick.
+static void mark_chunk_changed ( Region *region, uint32_t chunk, uint32_t types )
+{
+	if ( region->chunksChangedThisTick[ chunk ] == 0 ) region->changedChunks.push_back( chunk );
+	region->chunksChangedThisTick[ chunk ] |= types;
+}
+
+
+//////////////////////////////////
+// This function passes the chunks that
+// changed during this tick on to the meshers.
+// NOTE(Xavier): (2018.1.8) This is done once the tick has finished,
+// so a mesher never builds a chunk that is only half updated.
+static void publish_changed_chunks ( Region *region )
+{
+	if ( region->changedChunks.empty() ) return;
+
+	// NOTE(Xavier): (2018.1.9) The water snapshots work like a seqlock. The
+	// version is odd while they are copied, a mesher copies the snapshots
+	// it needs & starts again if the version changed in the meantime.
+	const uint32_t chunkSize = region->chunkLength*region->chunkWidth*region->chunkHeight;
+	uint32_t version = region->waterSnapshotVersion.load( std::memory_order_relaxed );
+	region->waterSnapshotVersion.store( version+1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+
+	for ( uint32_t chunk : region->changedChunks ) {
+		if ( region->chunksChangedThisTick[ chunk ] & Chunk_Mesh_Data_Type::WATER ) {
+			memcpy( region->chunks[ chunk ].waterSnapshot, region->chunks[ chunk ].water, chunkSize );
 		}
 	}
 
-	// TODO(Xavier): (2017.12.29)
-	// Abstract this away.
-#ifdef PLATFORM_OSX
-	mach_timebase_info_data_t timingInfoSimulation;
-	if ( mach_timebase_info (&timingInfoSimulation) != KERN_SUCCESS )
-		printf ("ERROR: mach_timebase_info failed\n");
-
-	static std::size_t startTime;
-	std::size_t endTime = mach_absolute_time();
-	std::size_t elapsedTime = endTime - startTime;
-	startTime = mach_absolute_time();
-	region->simulationDeltaTime = (elapsedTime * timingInfoSimulation.numer / timingInfoSimulation.denom) / 1000;
-#endif
+	region->waterSnapshotVersion.store( version+2, std::memory_order_release );
+
+	for ( uint32_t chunk : region->changedChunks ) {
+		region_mark_chunk_dirty( region, chunk, region->chunksChangedThisTick[ chunk ] );
+		region->chunksChangedThisTick[ chunk ] = 0;
+	}
+	region->changedChunks.clear();
 }
 
 
@@ -67,6 +224,8 @@ void region_simulate ( Region *region )
 // commands recieved form the main thread.
 static void process_commands ( Region *region )
 {
+	PROFILE_ZONE( ZONE_PROCESS_COMMANDS );
+
 	auto execute_command = [&]( Region_Command& command ) {
 		switch ( command.type ) {
 			case Region_Command_Type::GENERATE_DATA:
@@ -76,367 +235,945 @@ static void process_commands ( Region *region )
 			case Region_Command_Type::ROTATE_LEFT:
 				region->viewDirection++;
 				if ( region->viewDirection > 4 ) region->viewDirection = 1;
-				region->chunksNeedingMeshUpdate_mutex.lock();
 				for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
-					region->chunksNeedingMeshUpdate[i] = Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER;
+					region_mark_chunk_dirty( region, i, Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER );
 				}
-				region->chunksNeedingMeshUpdate_mutex.unlock();
 				break;
 
 			case Region_Command_Type::ROTATE_RIGHT:
 				region->viewDirection--;
 				if ( region->viewDirection < 1 ) region->viewDirection = 4;	
-				region->chunksNeedingMeshUpdate_mutex.lock();
 				for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
-					region->chunksNeedingMeshUpdate[i] = Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER;
+					region_mark_chunk_dirty( region, i, Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER );
 				}
-				region->chunksNeedingMeshUpdate_mutex.unlock();
 				break;
 
 			case Region_Command_Type::ADD_WATER_WAVE:
-				for ( int y = 0; y < region->width; ++y ) {
-					for ( int x = 0; x < region->length; ++x ) {
+				for ( int y = 0; y < (int)region->width; ++y ) {
+					for ( int x = 0; x < (int)region->length; ++x ) {
 						Chunk_Data *chunk = region_get_chunk( region, x, y, region->height-1 );
-						for ( int cy = 0; cy < region->chunkWidth; ++cy ) {
-							for ( int cx = 0; cx < region->chunkLength; ++cx ) {
+						mark_chunk_changed( region, x + y*region->length + (region->height-1)*region->length*region->width, Chunk_Mesh_Data_Type::WATER );
+						for ( int cy = 0; cy < (int)region->chunkWidth; ++cy ) {
+							for ( int cx = 0; cx < (int)region->chunkLength; ++cx ) {
 								uint8_t *water = &chunk->water[ cx + cy*region->chunkLength + (region->chunkHeight-1)*region->chunkLength*region->chunkWidth ];
 								*water = 255; //rand()%256;
-								if ( *water > 0 ) region->waterThatNeedsUpdate.emplace_back( cx+(x*region->chunkLength), cy+(y*region->chunkWidth), (region->chunkHeight-1)+((region->height-1)*region->chunkHeight), x + y*region->length + (region->height-1)*region->length*region->width );
+								if ( *water > 0 ) {
+									uint32_t index = (cx+(x*region->chunkLength)) + (cy+(y*region->chunkWidth))*region->worldLength + (region->worldHeight-1)*region->worldLength*region->worldWidth;
+									region->waterWokenTicks[ index ] = (uint16_t)region->waterTick;
+									add_active_water_cell( region, region->activeWater, index );
+								}
 							}
 						}
 					}
 				}
 				break;
 
+			case Region_Command_Type::SET_FLOOR:
+			case Region_Command_Type::SET_WALL:
+				// An edit waits behind the earlier ones so they are applied in order:
+				if ( !region->deferredEdits.empty() || !edit_tile( region, command ) ) region->deferredEdits.push_back( command );
+				break;
+
+			case Region_Command_Type::SET_WATER:
+				if ( (uint32_t)command.x < region->worldLength && (uint32_t)command.y < region->worldWidth && (uint32_t)command.z < region->worldHeight ) {
+					const uint32_t index = command.x + command.y*region->worldLength + command.z*region->worldLength*region->worldWidth;
+					set_active_water( region, command.x, command.y, command.z, command.amount < 255 ? command.amount : 255 );
+					region->waterWokenTicks[ index ] = (uint16_t)region->waterTick;
+					add_active_water_cell( region, region->activeWater, index );
+					mark_chunk_changed( region, region_get_chunk_index( region, command.x, command.y, command.z ), Chunk_Mesh_Data_Type::WATER );
+				}
+				break;
+
 			default: break;
 		}
 	};
 
-	if ( region->commandQue_mutex_1.try_lock() ) {
-		for ( auto& command : region->commandQue_1 ) {
-			execute_command( command );
+	// The edits that could not be applied last tick are tried first:
+	uint32_t applied = 0;
+	while ( applied < region->deferredEdits.size() && edit_tile( region, region->deferredEdits[ applied ] ) ) applied++;
+	region->deferredEdits.erase( region->deferredEdits.begin(), region->deferredEdits.begin() + applied );
+
+	Region_Command command;
+	while ( lockfree_queue_pop( &region->commandQueue, &command ) ) {
+		execute_command( command );
+	}
+}
+
+
+//////////////////////////////////
+// This function sets a floor or a wall & updates the
+// occlusion of the tiles around it. It returns false
+// without changing anything if a mesher is using one
+// of the chunks it would change.
+// NOTE(Xavier): (2018.1.13) Only the cells whose occlusion reads the edited
+// one are updated: the cell itself, its four sides & the cell below (whose
+// wall is hidden by the floor above it). Their chunks are claimed with
+// 'chunksBeingMeshed' while they are written, which a mesher treats as the
+// chunk being built by another mesher.
+static bool edit_tile ( Region *region, const Region_Command& command )
+{
+	const int x = command.x, y = command.y, z = command.z;
+	if ( (uint32_t)x >= region->worldLength || (uint32_t)y >= region->worldWidth || (uint32_t)z >= region->worldHeight ) return true;
+
+	const int cells [6][3] = { {x, y, z}, {x+1, y, z}, {x-1, y, z}, {x, y+1, z}, {x, y-1, z}, {x, y, z-1} };
+	uint32_t chunks [6];
+	uint32_t chunkCount = 0;
+	for ( const auto& cell : cells ) {
+		if ( (uint32_t)cell[0] >= region->worldLength || (uint32_t)cell[1] >= region->worldWidth || (uint32_t)cell[2] >= region->worldHeight ) continue;
+		const uint32_t chunk = region_get_chunk_index( region, cell[0], cell[1], cell[2] );
+		if ( std::find( chunks, chunks + chunkCount, chunk ) == chunks + chunkCount ) chunks[ chunkCount++ ] = chunk;
+	}
+
+	uint32_t claimed = 0;
+	while ( claimed < chunkCount && !region->chunksBeingMeshed[ chunks[ claimed ] ].exchange( true ) ) claimed++;
+
+	if ( claimed == chunkCount ) {
+		const uint32_t tile = command.tile & ~OCCLUSION_BIT;
+		if ( command.type == Region_Command_Type::SET_FLOOR ) region_set_floor( region, x, y, z, tile );
+		else region_set_wall( region, x, y, z, tile );
+		mark_chunk_changed( region, chunks[0], Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER );
+
+		for ( const auto& cell : cells ) update_occlusion( region, cell[0], cell[1], cell[2] );
+
+		// The water next to the tile may be able to move now:
+		region->waterWokenTicks[ x + y*region->worldLength + z*region->worldLength*region->worldWidth ] = (uint16_t)region->waterTick;
+		for ( const auto& cell : cells ) {
+			if ( region_get_water( region, cell[0], cell[1], cell[2] ) > 0 ) add_active_water( region, region->activeWater, cell[0], cell[1], cell[2] );
+		}
+		if ( region_get_water( region, x, y, z+1 ) > 0 ) add_active_water( region, region->activeWater, x, y, z+1 );
+	}
+
+	for ( uint32_t i = 0; i < claimed; ++i ) {
+		region->chunksBeingMeshed[ chunks[i] ] = false;
+		// A mesher that found the chunk busy left it for whoever claimed it to wake them:
+		if ( region->chunksNeedingMeshUpdate[ chunks[i] ] != 0 && region->meshWork != nullptr ) region->meshWork();
+	}
+
+	return claimed == chunkCount;
+}
+
+
+//////////////////////////////////
+// This function sets the occlusion bit of a floor
+// & a wall (given without it) if the tiles around
+// them hide them. The cell is in the coordinates of
+// the neighbourhood's chunk.
+static void get_occlusion ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z, uint32_t *floor, uint32_t *wall )
+{
+	auto floorAt = [&]( int x, int y, int z ) { return region_neighbourhood_get_floor( region, neighbourhood, x, y, z ) != Floor::FLOOR_NONE; };
+	auto wallAt = [&]( int x, int y, int z ) { return region_neighbourhood_get_wall( region, neighbourhood, x, y, z ) != Wall::WALL_NONE; };
+
+	// A floor is hidden by the wall on it & the floors on its four sides:
+	if ( *floor != Floor::FLOOR_NONE && *wall != Wall::WALL_NONE ) {
+		if ( floorAt( x-1, y, z ) && floorAt( x+1, y, z ) && floorAt( x, y-1, z ) && floorAt( x, y+1, z ) ) {
+			*floor |= OCCLUSION_BIT;
 		}
-		region->commandQue_1.clear();
-		region->commandQue_mutex_1.unlock();
 	}
-	
-	if ( region->commandQue_mutex_2.try_lock() ) {
-		for ( auto& command : region->commandQue_2 ) {
-			execute_command( command );
+
+	// A wall is hidden by the floor above it & the walls on its four sides:
+	if ( *wall != Wall::WALL_NONE && floorAt( x, y, z+1 ) ) {
+		if ( wallAt( x-1, y, z ) && wallAt( x+1, y, z ) && wallAt( x, y-1, z ) && wallAt( x, y+1, z ) ) {
+			*wall |= OCCLUSION_BIT;
 		}
-		region->commandQue_2.clear();
-		region->commandQue_mutex_2.unlock();
 	}
 }
 
 
+//////////////////////////////////
+// This function recomputes the occlusion of the
+// floor & wall at a location, & marks the meshes
+// of its chunk changed if it is different.
+static void update_occlusion ( Region *region, int x, int y, int z )
+{
+	if ( (uint32_t)x >= region->worldLength || (uint32_t)y >= region->worldWidth || (uint32_t)z >= region->worldHeight ) return;
+
+	const uint32_t chunk = region_get_chunk_index( region, x, y, z );
+	Region_Neighbourhood neighbourhood;
+	region_neighbourhood_init( region, &neighbourhood, chunk );
+
+	const uint32_t oldFloor = region_get_floor( region, x, y, z );
+	const uint32_t oldWall = region_get_wall( region, x, y, z );
+	uint32_t floor = oldFloor & ~OCCLUSION_BIT;
+	uint32_t wall = oldWall & ~OCCLUSION_BIT;
+	get_occlusion( region, &neighbourhood, x - neighbourhood.ox, y - neighbourhood.oy, z - neighbourhood.oz, &floor, &wall );
+
+	if ( floor != oldFloor ) {
+		region_set_floor( region, x, y, z, floor );
+		mark_chunk_changed( region, chunk, Chunk_Mesh_Data_Type::FLOOR );
+	}
+	if ( wall != oldWall ) {
+		region_set_wall( region, x, y, z, wall );
+		mark_chunk_changed( region, chunk, Chunk_Mesh_Data_Type::WALL );
+	}
+}
+
+
+//////////////////////////////////
+// This function returns the job system the region
+// was given, or creates one with 'waterThreadCount'
+// threads the first time it is needed.
+static Job_System* get_job_system ( Region *region )
+{
+	if ( region->jobSystem == nullptr ) {
+		region->jobSystem = job_system_create( region->waterThreadCount > 1 ? region->waterThreadCount-1 : 0 );
+		region->ownsJobSystem = true;
+	}
+	return region->jobSystem;
+}
+
+
 //////////////////////////////////
 // This function simulated the
 // the water for a single time-step
 // in the region.
-static void simulate_water ( Region *region, std::vector<uint32_t> &newChunksThatNeedUpdate )
+static void simulate_water ( Region *region )
 {
-	if ( region->waterThatNeedsUpdate.size() > 0 ) {
-		std::vector<vec4> newWaterThatNeedsUpdate;
+	if ( region->activeWater.size() > 0 ) {
+		PROFILE_ZONE( ZONE_SIMULATE_WATER );
+		const uint64_t startTime = Profiler::get_time();
+
+		get_job_system( region );
+
+		// The cells added during this tick are stamped with a new generation:
+		region->activeWaterUpdating.swap( region->activeWater );
+		region->activeWater.clear();
+		if ( ++region->activeWaterGeneration == 0 ) {
+			memset( region->activeWaterStamps, 0, region->worldLength*region->worldWidth*region->worldHeight*sizeof(uint16_t) );
+			region->activeWaterGeneration = 1;
+		}
 
-		static uint32_t lowestWater = 0;
-		static uint32_t highestWater = region->worldLength*region->worldWidth*region->worldHeight;
-		for ( uint32_t i = lowestWater; i < highestWater; ++i ) {
-			region->updatedWaterBitset[ i ] = false;
+		const uint32_t chunkCount = region->length*region->width*region->height;
+
+		for ( uint32_t index : region->activeWaterUpdating ) {
+			int x, y, z;
+			region_get_location( region, index, &x, &y, &z );
+			region->waterChunks[ region_get_chunk_index( region, x, y, z ) ].cells.push_back( index );
 		}
-		
-		uint32_t newLowestWater = region->worldLength*region->worldWidth*region->worldHeight;
-		uint32_t newHighestWater = 0;
-
-		for ( auto p : region->waterThatNeedsUpdate ) {
-			uint32_t bitPos = (int)(p.x) + (int)(p.y)*region->worldLength + (int)(p.z)*region->worldLength*region->worldWidth;
-			if ( region->updatedWaterBitset[ bitPos ] == true ) continue;
-			region->updatedWaterBitset[ bitPos ] = true;
-			if ( bitPos < newLowestWater ) newLowestWater = bitPos;
-			if ( bitPos+1 > newHighestWater ) newHighestWater = bitPos+1;
-
-			int sameDepth = region_get_water( region, p.x, p.y, p.z ) & 0xFF;
-			if ( sameDepth == 0 ) continue;
-
-			if ( region_get_floor(region, p.x, p.y, p.z) == Floor::FLOOR_NONE && region_get_wall(region, p.x, p.y, p.z-1) == Wall::WALL_NONE && region_get_water(region, p.x, p.y, p.z-1) < 255 ) {
-				int belowDepth = region_get_water( region, p.x, p.y, p.z-1 ) & 0xFF;
-				
-				belowDepth += sameDepth;
-				sameDepth = belowDepth - 255;
-				if ( sameDepth < 0 ) sameDepth = 0;
-				belowDepth -= sameDepth;
-
-				region_set_water( region, p.x, p.y, p.z, sameDepth );
-				region_set_water( region, p.x, p.y, p.z-1, belowDepth );
-
-				uint32_t cx = p.x / region->chunkLength;
-				uint32_t cy = p.y / region->chunkWidth;
-				uint32_t cz = (p.z-1) / region->chunkHeight;
-				uint32_t newChunkIndex = cx + cy*region->length + cz*region->length*region->width;
-				newChunksThatNeedUpdate[ newChunkIndex ] |= Chunk_Mesh_Data_Type::WATER;
-				newChunksThatNeedUpdate[ p.w ] |= Chunk_Mesh_Data_Type::WATER;
-				
-				if ( sameDepth > 0 ) newWaterThatNeedsUpdate.emplace_back( p );
-				newWaterThatNeedsUpdate.emplace_back( p.x, p.y, p.z-1, newChunkIndex );
+
+		// Chunks whose active layers are mostly active are updated by the dense path:
+		const uint32_t layerSize = region->chunkLength*region->chunkWidth;
+		uint32_t denseChunks = 0;
+		for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+			Water_Chunk& waterChunk = region->waterChunks[ chunk ];
+			waterChunk.dense = false;
+			if ( waterChunk.cells.size() < region->waterDenseFraction * layerSize ) continue;
+
+			waterChunk.denseLayers.assign( region->chunkHeight, 0 );
+			uint32_t layers = 0;
+			for ( uint32_t index : waterChunk.cells ) {
+				uint8_t& layer = waterChunk.denseLayers[ (index / (region->worldLength*region->worldWidth)) % region->chunkHeight ];
+				if ( layer == 0 ) layers++;
+				layer = 1;
+			}
+			waterChunk.dense = waterChunk.cells.size() >= region->waterDenseFraction * layers * layerSize;
+			if ( waterChunk.dense ) denseChunks++;
+		}
+		region->numberOfDenseWaterChunks = denseChunks;
+
+		// NOTE(Xavier): (2018.1.9) Updating a cell reads & writes the cells
+		// next to it, so it can reach one cell into the neighbouring chunks.
+		// The chunks are split into 8 phases by the parity of their x, y & z,
+		// the chunks in a phase are at least one chunk apart so they never
+		// touch the same cell (as long as chunks are 2 or more cells wide)
+		// and can be updated at the same time.
+		struct Water_Phase { Region *region; std::vector<uint32_t> chunks; uint64_t deadline; } phase;
+		phase.region = region;
+		phase.deadline = UINT64_MAX;
+
+		// NOTE(Xavier): (2018.1.10) With a budget, the chunks that have not
+		// started when it runs out are carried over to the next tick. The
+		// first phase always runs so the water can not stop altogether,
+		// and the order of the phases rotates each tick so the same chunks
+		// are not always the ones that are carried over.
+		const uint32_t firstParity = region->waterTickBudget > 0 ? region->waterTick % 8 : 0;
+
+		for ( uint32_t phaseNumber = 0; phaseNumber < 8; ++phaseNumber ) {
+			const uint32_t parity = (firstParity + phaseNumber) % 8;
+			if ( phaseNumber == 1 && region->waterTickBudget > 0 ) phase.deadline = startTime + region->waterTickBudget;
+
+			phase.chunks.clear();
+			for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+				if ( region->waterChunks[ chunk ].cells.empty() ) continue;
+				const uint32_t cz = chunk / (region->length*region->width);
+				const uint32_t cy = (chunk / region->length) % region->width;
+				const uint32_t cx = chunk % region->length;
+				if ( ((cx & 1) | (cy & 1) << 1 | (cz & 1) << 2) == parity ) phase.chunks.push_back( chunk );
 			}
 
-			if ( sameDepth > 0 ) {
-				int sides = 1;
-				int xpw = region_get_wall(region, p.x+1, p.y, p.z ); if ( p.x+1 == region->worldLength ) xpw = Wall::WALL_STONE;
-				int xnw = region_get_wall(region, p.x-1, p.y, p.z ); if ( p.x-1 < 0 ) xnw = Wall::WALL_STONE;
-				int ypw = region_get_wall(region, p.x, p.y+1, p.z ); if ( p.y+1 == region->worldWidth ) ypw = Wall::WALL_STONE;
-				int ynw = region_get_wall(region, p.x, p.y-1, p.z ); if ( p.y-1 < 0) ynw = Wall::WALL_STONE;
-				if ( xpw == Wall::WALL_NONE ) sides++;
-				if ( xnw == Wall::WALL_NONE ) sides++;
-				if ( ypw == Wall::WALL_NONE ) sides++;
-				if ( ynw == Wall::WALL_NONE ) sides++;
-				int xp = region_get_water( region, p.x+1, p.y, p.z ) & 0xFF;
-				int xn = region_get_water( region, p.x-1, p.y, p.z ) & 0xFF;
-				int yp = region_get_water( region, p.x, p.y+1, p.z ) & 0xFF;
-				int yn = region_get_water( region, p.x, p.y-1, p.z ) & 0xFF;
-				int average = (sameDepth + xp + xn + yp + yn) / sides;
-
-				if ( average == sameDepth ) continue;
-
-				if ( sides > 1 ) {
-					if ( (region_get_water(region, p.x, p.y, p.z+1 ) & 0xFF) > 0 ) {
-						uint32_t cx = p.x / region->chunkLength;
-						uint32_t cy = p.y / region->chunkWidth;
-						uint32_t cz = (p.z+1) / region->chunkHeight;
-						uint32_t newChunkIndex = cx + cy*region->length + cz*region->length*region->width;
-						newChunksThatNeedUpdate[ newChunkIndex ] |= Chunk_Mesh_Data_Type::WATER;
-						newWaterThatNeedsUpdate.emplace_back( p.x, p.y, p.z+1, newChunkIndex );
+			job_system_run( region->jobSystem, phase.chunks.size(), []( void *data, uint32_t item ) {
+				Water_Phase *phase = (Water_Phase*)data;
+				Water_Chunk& waterChunk = phase->region->waterChunks[ phase->chunks[ item ] ];
+				if ( phase->deadline != UINT64_MAX && Profiler::get_time() > phase->deadline ) waterChunk.carriedOver = true;
+				else if ( waterChunk.dense ) simulate_dense_water_chunk( phase->region, phase->chunks[ item ] );
+				else simulate_water_chunk( phase->region, phase->chunks[ item ] );
+			}, &phase );
+		}
+
+		// NOTE(Xavier): (2018.1.14) A dense chunk leaves the pairs across its +x
+		// & +y borders to a dense neighbour there. If that neighbour was carried
+		// over they are moved now, from the side that was updated, so the
+		// border does not stop while the chunk next to it waits.
+		for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+			const Water_Chunk& waterChunk = region->waterChunks[ chunk ];
+			if ( !waterChunk.carriedOver || !waterChunk.dense ) continue;
+
+			auto updated_dense = [&]( uint32_t other ) { return region->waterChunks[ other ].dense && !region->waterChunks[ other ].carriedOver && !region->waterChunks[ other ].cells.empty(); };
+			if ( chunk % region->length > 0 && updated_dense( chunk-1 ) ) move_dense_water_border( region, chunk-1, 1, 0 );
+			if ( (chunk / region->length) % region->width > 0 && updated_dense( chunk-region->length ) ) move_dense_water_border( region, chunk-region->length, 0, 1 );
+		}
+
+		// The results are gathered in chunk order, so the next
+		// tick does not depend on which thread updated a chunk:
+		if ( region->waterSleepTicks == 0 ) {
+			for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+				Water_Chunk& waterChunk = region->waterChunks[ chunk ];
+				region->activeWater.insert( region->activeWater.end(), waterChunk.added.begin(), waterChunk.added.end() );
+			}
+		}
+		else {
+			uint32_t fellAsleep = 0;
+			for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+				for ( uint32_t index : region->waterChunks[ chunk ].added ) {
+					if ( is_water_asleep( region, index ) ) {
+						region->waterAsleep[ index ] = 1;
+						fellAsleep++;
+					}
+					else {
+						region->activeWater.push_back( index ); // Already stamped when it was added.
 					}
 				}
-				
-				int mod = (sameDepth + xp + xn + yp + yn) % sides;
-
-				// NOTE(Xavier): This is to help the system get into a steady state.
-				if ( xp && xn && yp && yn && mod != 0 && rand()%100 == 1 ) mod = 0;
-				else if ( mod != 0 && rand()%500 == 1 ) mod = 0;
-
-				int modxp = 0;
-				int modxn = 0;
-				int modyp = 0;
-				int modyn = 0;
-
-				switch ( mod ) {
-					case 1:
-						switch ( sides ) {
-							case 2:
-								if ( !xpw ) modxp = 1;
-								if ( !xnw ) modxn = 1;
-								if ( !ypw ) modyp = 1;
-								if ( !ynw ) modyn = 1;
-								break;
-							case 3:
-								if ( !xpw && !xnw ) {
-									switch (rand()%2) {
-										case 0: modxp = 1; break;
-										case 1: modxn = 1; break;
-									}
-								}
-								else if ( !xpw && !ynw ) {
-									switch (rand()%2) {
-										case 0: modxp = 1; break;
-										case 1: modyn = 1; break;
-									}
-								}
-								else if ( !xpw && !ypw ) {
-									switch (rand()%2) {
-										case 0: modxp = 1; break;
-										case 1: modyp = 1; break;
-									}
+			}
+			region->numberOfWaterSleeping += fellAsleep;
+		}
+
+		uint32_t carriedOver = 0;
+		for ( uint32_t chunk = 0; chunk < chunkCount; ++chunk ) {
+			Water_Chunk& waterChunk = region->waterChunks[ chunk ];
+			for ( uint32_t changed : waterChunk.changed ) mark_chunk_changed( region, changed, Chunk_Mesh_Data_Type::WATER );
+
+			if ( waterChunk.carriedOver ) {
+				for ( uint32_t index : waterChunk.cells ) add_active_water_cell( region, region->activeWater, index );
+				carriedOver += waterChunk.cells.size();
+				waterChunk.carriedOver = false;
+			}
+
+			waterChunk.cells.clear();
+			waterChunk.added.clear();
+			waterChunk.changed.clear();
+		}
+		region->numberOfWaterCarriedOver = carriedOver;
+
+		region->waterTick++;
+		region->numberOfWaterBeingUpdated = region->activeWater.size();
+	}
+}
+
+
+//////////////////////////////////
+// This function lets water fall into the
+// cell below it if it can, & returns the
+// depth that is left in the cell. The cell
+// must be in the neighbourhood's chunk.
+static int fall_water ( Region *region, Water_Chunk *waterChunk, uint32_t chunk, const Region_Neighbourhood *neighbourhood, int x, int y, int z, int sameDepth )
+{
+	const int lx = x - neighbourhood->ox;
+	const int ly = y - neighbourhood->oy;
+	const int lz = z - neighbourhood->oz;
+
+	if ( region_neighbourhood_get_floor(region, neighbourhood, lx, ly, lz) == Floor::FLOOR_NONE && region_neighbourhood_get_wall(region, neighbourhood, lx, ly, lz-1) == Wall::WALL_NONE && region_neighbourhood_get_water(region, neighbourhood, lx, ly, lz-1) < 255 ) {
+		int belowDepth = region_neighbourhood_get_water( region, neighbourhood, lx, ly, lz-1 ) & 0xFF;
+		
+		belowDepth += sameDepth;
+		sameDepth = belowDepth - 255;
+		if ( sameDepth < 0 ) sameDepth = 0;
+		belowDepth -= sameDepth;
+
+		set_active_water( region, x, y, z, sameDepth );
+		set_active_water( region, x, y, z-1, belowDepth );
+
+		uint32_t newChunkIndex = region_get_chunk_index( region, x, y, z-1 );
+		mark_water_changed( waterChunk, newChunkIndex );
+		mark_water_changed( waterChunk, chunk );
+		
+		if ( sameDepth > 0 ) add_active_water( region, waterChunk->added, x, y, z );
+		add_active_water( region, waterChunk->added, x, y, z-1 );
+	}
+
+	return sameDepth;
+}
+
+
+//////////////////////////////////
+// This function updates the active water
+// of one chunk. It can run at the same time
+// as other chunks of the same phase.
+static void simulate_water_chunk ( Region *region, uint32_t chunk )
+{
+	Water_Chunk& waterChunk = region->waterChunks[ chunk ];
+
+	// Each chunk has its own random sequence for each tick,
+	// so the result is the same for any number of threads:
+	Random random;
+	random_seed( &random, region->seed ^ (region->waterTick * 0x9E3779B97F4A7C15ull) ^ ((uint64_t)chunk << 40) );
+
+	Region_Neighbourhood neighbourhood;
+	region_neighbourhood_init( region, &neighbourhood, chunk );
+	const Region_Neighbourhood *n = &neighbourhood;
+
+	for ( uint32_t index : waterChunk.cells ) {
+		int x, y, z;
+		region_get_location( region, index, &x, &y, &z );
+		const int lx = x - n->ox;
+		const int ly = y - n->oy;
+		const int lz = z - n->oz;
+
+		int sameDepth = region_neighbourhood_get_water( region, n, lx, ly, lz ) & 0xFF;
+		if ( sameDepth == 0 ) continue;
+
+		sameDepth = fall_water( region, &waterChunk, chunk, n, x, y, z, sameDepth );
+
+		if ( sameDepth > 0 ) {
+			int sides = 1;
+			int xpw = region_neighbourhood_get_wall(region, n, lx+1, ly, lz ); if ( x+1 == (int)region->worldLength ) xpw = Wall::WALL_STONE;
+			int xnw = region_neighbourhood_get_wall(region, n, lx-1, ly, lz ); if ( x-1 < 0 ) xnw = Wall::WALL_STONE;
+			int ypw = region_neighbourhood_get_wall(region, n, lx, ly+1, lz ); if ( y+1 == (int)region->worldWidth ) ypw = Wall::WALL_STONE;
+			int ynw = region_neighbourhood_get_wall(region, n, lx, ly-1, lz ); if ( y-1 < 0) ynw = Wall::WALL_STONE;
+			if ( xpw == Wall::WALL_NONE ) sides++;
+			if ( xnw == Wall::WALL_NONE ) sides++;
+			if ( ypw == Wall::WALL_NONE ) sides++;
+			if ( ynw == Wall::WALL_NONE ) sides++;
+			int xp = region_neighbourhood_get_water( region, n, lx+1, ly, lz ) & 0xFF;
+			int xn = region_neighbourhood_get_water( region, n, lx-1, ly, lz ) & 0xFF;
+			int yp = region_neighbourhood_get_water( region, n, lx, ly+1, lz ) & 0xFF;
+			int yn = region_neighbourhood_get_water( region, n, lx, ly-1, lz ) & 0xFF;
+			int average = (sameDepth + xp + xn + yp + yn) / sides;
+
+			if ( average == sameDepth ) {
+				// The average does not move a slope (eg. a cell halfway between its
+				// neighbours), so half of the steepest step is moved on its own:
+				int step = 1, dx = 0, dy = 0;
+				if ( xpw == Wall::WALL_NONE && abs( xp - sameDepth ) > step ) { step = abs( xp - sameDepth ); dx = 1; dy = 0; }
+				if ( xnw == Wall::WALL_NONE && abs( xn - sameDepth ) > step ) { step = abs( xn - sameDepth ); dx = -1; dy = 0; }
+				if ( ypw == Wall::WALL_NONE && abs( yp - sameDepth ) > step ) { step = abs( yp - sameDepth ); dx = 0; dy = 1; }
+				if ( ynw == Wall::WALL_NONE && abs( yn - sameDepth ) > step ) { step = abs( yn - sameDepth ); dx = 0; dy = -1; }
+				if ( dx == 0 && dy == 0 ) continue;
+
+				const int other = region_neighbourhood_get_water( region, n, lx+dx, ly+dy, lz ) & 0xFF;
+				const int flow = (sameDepth - other) / 2;
+				set_active_water( region, x, y, z, sameDepth - flow );
+				set_active_water( region, x+dx, y+dy, z, other + flow );
+				mark_water_changed( &waterChunk, chunk );
+				mark_water_changed( &waterChunk, region_get_chunk_index( region, x+dx, y+dy, z ) );
+				add_active_water( region, waterChunk.added, x, y, z );
+				add_active_water( region, waterChunk.added, x+dx, y+dy, z );
+				if ( (region_neighbourhood_get_water( region, n, lx, ly, lz+1 ) & 0xFF) > 0 ) add_active_water( region, waterChunk.added, x, y, z+1 );
+				if ( (region_neighbourhood_get_water( region, n, lx+dx, ly+dy, lz+1 ) & 0xFF) > 0 ) add_active_water( region, waterChunk.added, x+dx, y+dy, z+1 );
+				continue;
+			}
+
+			if ( sides > 1 ) {
+				if ( (region_neighbourhood_get_water(region, n, lx, ly, lz+1 ) & 0xFF) > 0 ) {
+					uint32_t newChunkIndex = region_get_chunk_index( region, x, y, z+1 );
+					mark_water_changed( &waterChunk, newChunkIndex );
+					add_active_water( region, waterChunk.added, x, y, z+1 );
+				}
+			}
+			
+			int mod = (sameDepth + xp + xn + yp + yn) % sides;
+
+			// NOTE(Xavier): This is to help the system get into a steady state.
+			if ( xp && xn && yp && yn && mod != 0 && random_range(&random, 100) == 1 ) mod = 0;
+			else if ( mod != 0 && random_range(&random, 500) == 1 ) mod = 0;
+
+			int modxp = 0;
+			int modxn = 0;
+			int modyp = 0;
+			int modyn = 0;
+
+			switch ( mod ) {
+				case 1:
+					switch ( sides ) {
+						case 2:
+							if ( !xpw ) modxp = 1;
+							if ( !xnw ) modxn = 1;
+							if ( !ypw ) modyp = 1;
+							if ( !ynw ) modyn = 1;
+							break;
+						case 3:
+							if ( !xpw && !xnw ) {
+								switch (random_range(&random, 2)) {
+									case 0: modxp = 1; break;
+									case 1: modxn = 1; break;
 								}
-								else if ( !xnw && !ypw ) {
-									switch (rand()%2) {
-										case 0: modxn = 1; break;
-										case 1: modyp = 1; break;
-									}
+							}
+							else if ( !xpw && !ynw ) {
+								switch (random_range(&random, 2)) {
+									case 0: modxp = 1; break;
+									case 1: modyn = 1; break;
 								}
-								else if ( !xnw && !ynw ) {
-									switch (rand()%2) {
-										case 0: modxn = 1; break;
-										case 1: modyn = 1; break;
-									}
+							}
+							else if ( !xpw && !ypw ) {
+								switch (random_range(&random, 2)) {
+									case 0: modxp = 1; break;
+									case 1: modyp = 1; break;
 								}
-								else if ( !ynw && !ypw ) {
-									switch (rand()%2) {
-										case 0: modyn = 1; break;
-										case 1: modyp = 1; break;
-									}
+							}
+							else if ( !xnw && !ypw ) {
+								switch (random_range(&random, 2)) {
+									case 0: modxn = 1; break;
+									case 1: modyp = 1; break;
 								}
-								break;
-							case 4:
-								if ( !xpw && !xnw && !ypw ) {
-									switch (rand()%3) {
-										case 0: modxp = 0; modxn = 0; modyp = 1; break;
-										case 1: modxp = 1; modxn = 0; modyp = 0; break;
-										case 2: modxp = 0; modxn = 1; modyp = 0; break;
-									}
+							}
+							else if ( !xnw && !ynw ) {
+								switch (random_range(&random, 2)) {
+									case 0: modxn = 1; break;
+									case 1: modyn = 1; break;
 								}
-								else if ( !xpw && !xnw && !ynw ) {
-									switch (rand()%3) {
-										case 0: modxp = 0; modxn = 0; modyn = 1; break;
-										case 1: modxp = 1; modxn = 0; modyn = 0; break;
-										case 2: modxp = 0; modxn = 1; modyn = 0; break;
-									}
+							}
+							else if ( !ynw && !ypw ) {
+								switch (random_range(&random, 2)) {
+									case 0: modyn = 1; break;
+									case 1: modyp = 1; break;
 								}
-								else if ( !xpw && !ynw && !ypw ) {
-									switch (rand()%3) {
-										case 0: modxp = 0; modyn = 0; modyp = 1; break;
-										case 1: modxp = 1; modyn = 0; modyp = 0; break;
-										case 2: modxp = 0; modyn = 1; modyp = 0; break;
-									}
+							}
+							break;
+						case 4:
+							if ( !xpw && !xnw && !ypw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modxp = 0; modxn = 0; modyp = 1; break;
+									case 1: modxp = 1; modxn = 0; modyp = 0; break;
+									case 2: modxp = 0; modxn = 1; modyp = 0; break;
 								}
-								else if ( !ynw && !xnw && !ypw ) {
-									switch (rand()%3) {
-										case 0: modyn = 0; modxn = 0; modyp = 1; break;
-										case 1: modyn = 1; modxn = 0; modyp = 0; break;
-										case 2: modyn = 0; modxn = 1; modyp = 0; break;
-									}
+							}
+							else if ( !xpw && !xnw && !ynw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modxp = 0; modxn = 0; modyn = 1; break;
+									case 1: modxp = 1; modxn = 0; modyn = 0; break;
+									case 2: modxp = 0; modxn = 1; modyn = 0; break;
 								}
-								break;
-							case 5:
-								switch (rand()%4) {
-									case 0: modxp = 1; break;
-									case 1: modxn = 1; break;
-									case 2: modyp = 1; break;
-									case 3: modyn = 1; break;
+							}
+							else if ( !xpw && !ynw && !ypw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modxp = 0; modyn = 0; modyp = 1; break;
+									case 1: modxp = 1; modyn = 0; modyp = 0; break;
+									case 2: modxp = 0; modyn = 1; modyp = 0; break;
 								}
-								break;
-						}
-						break;
-					case 2:
-						switch ( sides ) {
-							case 3:
-								if ( !xpw && !xnw ) modxp = 1; modxn = 1;
-								if ( !xpw && !ynw ) modxp = 1; modyn = 1;
-								if ( !xpw && !ypw ) modxp = 1; modyp = 1;
-								if ( !xnw && !ypw ) modxn = 1; modyp = 1;
-								if ( !xnw && !ynw ) modxn = 1; modyn = 1;
-								if ( !ynw && !ypw ) modyn = 1; modyp = 1;
-								break;
-							case 4:
-								if ( !xpw && !xnw && !ypw ) {
-									switch (rand()%3) {
-										case 0: modxp = 0; modxn = 1; modyp = 1; break;
-										case 1: modxp = 1; modxn = 0; modyp = 1; break;
-										case 2: modxp = 1; modxn = 1; modyp = 0; break;
-									}
+							}
+							else if ( !ynw && !xnw && !ypw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modyn = 0; modxn = 0; modyp = 1; break;
+									case 1: modyn = 1; modxn = 0; modyp = 0; break;
+									case 2: modyn = 0; modxn = 1; modyp = 0; break;
 								}
-								if ( !xpw && !xnw && !ynw ) {
-									switch (rand()%3) {
-										case 0: modxp = 0; modxn = 1; modyn = 1; break;
-										case 1: modxp = 1; modxn = 0; modyn = 1; break;
-										case 2: modxp = 1; modxn = 1; modyn = 0; break;
-									}
+							}
+							break;
+						case 5:
+							switch (random_range(&random, 4)) {
+								case 0: modxp = 1; break;
+								case 1: modxn = 1; break;
+								case 2: modyp = 1; break;
+								case 3: modyn = 1; break;
+							}
+							break;
+					}
+					break;
+				case 2:
+					switch ( sides ) {
+						case 3:
+							if ( !xpw && !xnw ) modxp = 1; modxn = 1;
+							if ( !xpw && !ynw ) modxp = 1; modyn = 1;
+							if ( !xpw && !ypw ) modxp = 1; modyp = 1;
+							if ( !xnw && !ypw ) modxn = 1; modyp = 1;
+							if ( !xnw && !ynw ) modxn = 1; modyn = 1;
+							if ( !ynw && !ypw ) modyn = 1; modyp = 1;
+							break;
+						case 4:
+							if ( !xpw && !xnw && !ypw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modxp = 0; modxn = 1; modyp = 1; break;
+									case 1: modxp = 1; modxn = 0; modyp = 1; break;
+									case 2: modxp = 1; modxn = 1; modyp = 0; break;
 								}
-								if ( !xpw && !ynw && !ypw ) {
-									switch (rand()%3) {
-										case 0: modxp = 0; modyn = 1; modyp = 1; break;
-										case 1: modxp = 1; modyn = 0; modyp = 1; break;
-										case 2: modxp = 1; modyn = 1; modyp = 0; break;
-									}
+							}
+							if ( !xpw && !xnw && !ynw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modxp = 0; modxn = 1; modyn = 1; break;
+									case 1: modxp = 1; modxn = 0; modyn = 1; break;
+									case 2: modxp = 1; modxn = 1; modyn = 0; break;
 								}
-								if ( !ynw && !xnw && !ypw ) {
-									switch (rand()%3) {
-										case 0: modyn = 0; modxn = 1; modyp = 1; break;
-										case 1: modyn = 1; modxn = 0; modyp = 1; break;
-										case 2: modyn = 1; modxn = 1; modyp = 0; break;
-									}
+							}
+							if ( !xpw && !ynw && !ypw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modxp = 0; modyn = 1; modyp = 1; break;
+									case 1: modxp = 1; modyn = 0; modyp = 1; break;
+									case 2: modxp = 1; modyn = 1; modyp = 0; break;
 								}
-								break;
-							case 5:
-								switch (rand()%2) {
-									case 0: modxp = 1; modxn = 1; break;
-									case 1: modyp = 1; modyn = 1; break;
+							}
+							if ( !ynw && !xnw && !ypw ) {
+								switch (random_range(&random, 3)) {
+									case 0: modyn = 0; modxn = 1; modyp = 1; break;
+									case 1: modyn = 1; modxn = 0; modyp = 1; break;
+									case 2: modyn = 1; modxn = 1; modyp = 0; break;
 								}
-								break;
-						}
-						break;
-					case 3:
-						if ( sides == 4 ) {
-							if ( !xpw && !xnw && !ypw ) modxp = 1; modxn = 1; modyp = 1;
-							if ( !xpw && !xnw && !ynw ) modxp = 1; modxn = 1; modyn = 1;
-							if ( !xpw && !ynw && !ypw ) modxp = 1; modyn = 1; modyp = 1;
-							if ( !ynw && !xnw && !ypw ) modyn = 1; modxn = 1; modyp = 1;
-						}
-						else if ( sides == 5 ) {
-							switch (rand()%4) {
-								case 0: modxp = 1; modxn = 1; modyp = 1; break;
-								case 1: modxp = 1; modxn = 1; modyn = 1; break;
-								case 2: modyp = 1; modxp = 1; modyp = 1; break;
-								case 3: modyn = 1; modyp = 1; modxn = 1; break;
 							}
+							break;
+						case 5:
+							switch (random_range(&random, 2)) {
+								case 0: modxp = 1; modxn = 1; break;
+								case 1: modyp = 1; modyn = 1; break;
+							}
+							break;
+					}
+					break;
+				case 3:
+					if ( sides == 4 ) {
+						if ( !xpw && !xnw && !ypw ) modxp = 1; modxn = 1; modyp = 1;
+						if ( !xpw && !xnw && !ynw ) modxp = 1; modxn = 1; modyn = 1;
+						if ( !xpw && !ynw && !ypw ) modxp = 1; modyn = 1; modyp = 1;
+						if ( !ynw && !xnw && !ypw ) modyn = 1; modxn = 1; modyp = 1;
+					}
+					else if ( sides == 5 ) {
+						switch (random_range(&random, 4)) {
+							case 0: modxp = 1; modxn = 1; modyp = 1; break;
+							case 1: modxp = 1; modxn = 1; modyn = 1; break;
+							case 2: modyp = 1; modxp = 1; modyp = 1; break;
+							case 3: modyn = 1; modyp = 1; modxn = 1; break;
 						}
-						break;
-					case 4:
-						modxp = 1;
-						modxn = 1;
-						modyp = 1;
-						modyn = 1;
-						break;
-				}
+					}
+					break;
+				case 4:
+					modxp = 1;
+					modxn = 1;
+					modyp = 1;
+					modyn = 1;
+					break;
+			}
 
-				if ( xpw == Wall::WALL_NONE ) {
-					region_set_water( region, p.x+1, p.y, p.z, average + modxp );
+			if ( xpw == Wall::WALL_NONE ) {
+				set_active_water( region, x+1, y, z, average + modxp );
 
-					uint32_t cx = (p.x+1) / region->chunkLength;
-					uint32_t cy = p.y / region->chunkWidth;
-					uint32_t cz = p.z / region->chunkHeight;
-					uint32_t newChunkIndex = cx + cy*region->length + cz*region->length*region->width;
-					newChunksThatNeedUpdate[ newChunkIndex ] |= Chunk_Mesh_Data_Type::WATER;
-					newWaterThatNeedsUpdate.emplace_back( p.x+1, p.y, p.z, newChunkIndex );
-				}
+				uint32_t newChunkIndex = region_get_chunk_index( region, x+1, y, z );
+				mark_water_changed( &waterChunk, newChunkIndex );
+				add_active_water( region, waterChunk.added, x+1, y, z );
+			}
 
-				if ( xnw == Wall::WALL_NONE ) {
-					region_set_water( region, p.x-1, p.y, p.z, average + modxn );
+			if ( xnw == Wall::WALL_NONE ) {
+				set_active_water( region, x-1, y, z, average + modxn );
 
-					uint32_t cx = (p.x-1) / region->chunkLength;
-					uint32_t cy = p.y / region->chunkWidth;
-					uint32_t cz = p.z / region->chunkHeight;
-					uint32_t newChunkIndex = cx + cy*region->length + cz*region->length*region->width;
-					newChunksThatNeedUpdate[ newChunkIndex ] |= Chunk_Mesh_Data_Type::WATER;
-					newWaterThatNeedsUpdate.emplace_back( p.x-1, p.y, p.z, newChunkIndex );
-				}
+				uint32_t newChunkIndex = region_get_chunk_index( region, x-1, y, z );
+				mark_water_changed( &waterChunk, newChunkIndex );
+				add_active_water( region, waterChunk.added, x-1, y, z );
+			}
 
-				if ( ypw == Wall::WALL_NONE ) {
-					region_set_water( region, p.x, p.y+1, p.z, average + modyp );
+			if ( ypw == Wall::WALL_NONE ) {
+				set_active_water( region, x, y+1, z, average + modyp );
 
-					uint32_t cx = p.x / region->chunkLength;
-					uint32_t cy = (p.y+1) / region->chunkWidth;
-					uint32_t cz = p.z / region->chunkHeight;
-					uint32_t newChunkIndex = cx + cy*region->length + cz*region->length*region->width;
-					newChunksThatNeedUpdate[ newChunkIndex ] |= Chunk_Mesh_Data_Type::WATER;
-					newWaterThatNeedsUpdate.emplace_back( p.x, p.y+1, p.z, newChunkIndex );
-				}
+				uint32_t newChunkIndex = region_get_chunk_index( region, x, y+1, z );
+				mark_water_changed( &waterChunk, newChunkIndex );
+				add_active_water( region, waterChunk.added, x, y+1, z );
+			}
+
+			if ( ynw == Wall::WALL_NONE ) {
+				set_active_water( region, x, y-1, z, average + modyn );
+
+				uint32_t newChunkIndex = region_get_chunk_index( region, x, y-1, z );
+				mark_water_changed( &waterChunk, newChunkIndex );
+				add_active_water( region, waterChunk.added, x, y-1, z );
+			}
+
+			set_active_water( region, x, y, z, average );
+			mark_water_changed( &waterChunk, chunk );
+		}
+	}
+}
+
+
+//////////////////////////////////
+// NOTE(Xavier): (2018.1.10) When most of the cells in the active layers of
+// a chunk are active it is cheaper to spread the water of whole layers at
+// once than to update the cells one at a time. The dense path lets the
+// active water fall as usual, then water flows between every pair of open
+// cells next to each other in those layers: a fifth of the difference in
+// depth (rounded towards zero) flows from the deeper cell to the other.
+// Each pair gives & takes the same amount so no water is lost, and as the
+// new depths only depend on the old ones, 8 cells are updated at a time.
+// A difference under 5 is too small to flow that way, so each tick one in
+// four of the pairs (every other pair along x or along y, in turn) moves
+// half of it, rounded up, instead. A cell is in at most one of those pairs
+// so it can not overshoot, & the pairs 2 to 4 apart stay active until their
+// turn comes, so a slope settles instead of staying forever. The single
+// units that move on a slope of 1 per cell keep making those pairs, so it
+// flattens out as well.
+// A layer is copied into grids of 16 bit values with a one cell border (the
+// halo) from the neighbouring chunks. The pairs across the border are moved
+// by this chunk, unless the neighbour on the +x or +y side is also dense &
+// spreads the same layer, in which case it moves them, so each pair only
+// moves once per tick.
+
+//////////////////////////////////
+// Returns true if the pair of the cell at 'x'
+// & the one after it (along y if 'alongY')
+// has its turn to settle this tick.
+inline bool dense_water_settles ( Region *region, int x, bool alongY )
+{
+	const uint32_t turn = region->waterTick % 4;
+	return (turn & 1) == (alongY ? 1u : 0u) && ((x + (turn >> 1)) & 1) == 0;
+}
+
+//////////////////////////////////
+// Returns the water that flows from a cell
+// of depth 'a' to a cell of depth 'b'.
+inline int dense_water_flow ( int a, int b, bool settles )
+{
+	const int half = (abs( a - b ) + 1) / 2;
+	if ( abs( a - b ) < 5 ) return settles ? (a < b ? -half : half) : 0;
+	return (a - b) / 5;
+}
+
+//////////////////////////////////
+// Returns true if a pair is too close
+// to flow unless it has its turn.
+inline bool dense_water_stuck ( int a, int b )
+{
+	return abs( a - b ) > 1 && abs( a - b ) < 5;
+}
+
+#if SSE_SUPPORT
+//////////////////////////////////
+// The same as 'dense_water_flow' for 8 pairs,
+// 'settles' is -1 for the pairs that have
+// their turn. The division by 5 is a multiply
+// by 2^16/5, which is exact up to 255.
+inline __m128i dense_water_flow ( __m128i a, __m128i b, __m128i settles )
+{
+	__m128i difference = _mm_sub_epi16( a, b );
+	__m128i sign = _mm_srai_epi16( difference, 15 );
+	__m128i magnitude = _mm_sub_epi16( _mm_xor_si128( difference, sign ), sign );
+	__m128i flow = _mm_mulhi_epu16( magnitude, _mm_set1_epi16( 13108 ) );
+	__m128i half = _mm_srli_epi16( _mm_add_epi16( magnitude, _mm_set1_epi16( 1 ) ), 1 );
+	half = _mm_and_si128( half, _mm_and_si128( settles, _mm_cmplt_epi16( magnitude, _mm_set1_epi16( 5 ) ) ) );
+	flow = _mm_or_si128( flow, half );
+	return _mm_sub_epi16( _mm_xor_si128( flow, sign ), sign );
+}
+
+//////////////////////////////////
+// The same as 'dense_water_stuck' for 8 pairs.
+inline __m128i dense_water_stuck ( __m128i a, __m128i b )
+{
+	__m128i difference = _mm_sub_epi16( a, b );
+	__m128i magnitude = _mm_max_epi16( difference, _mm_sub_epi16( _mm_setzero_si128(), difference ) );
+	return _mm_and_si128( _mm_cmpgt_epi16( magnitude, _mm_set1_epi16( 1 ) ), _mm_cmplt_epi16( magnitude, _mm_set1_epi16( 5 ) ) );
+}
+#endif
+
+//////////////////////////////////
+// This function updates the active water of one
+// chunk with the dense path. It can run at the same
+// time as other chunks of the same phase.
+static void simulate_dense_water_chunk ( Region *region, uint32_t chunk )
+{
+	Water_Chunk& waterChunk = region->waterChunks[ chunk ];
+	Chunk_Data *chunkData = &region->chunks[ chunk ];
+
+	// The layers that had active water at the start of the tick are spread, the
+	// neighbours read them to know which of the pairs on the borders they move:
+	Region_Neighbourhood neighbourhood;
+	region_neighbourhood_init( region, &neighbourhood, chunk );
+	const int ox = neighbourhood.ox;
+	const int oy = neighbourhood.oy;
+	const int oz = neighbourhood.oz;
+
+	for ( uint32_t index : waterChunk.cells ) {
+		int x, y, z;
+		region_get_location( region, index, &x, &y, &z );
 
-				if ( ynw == Wall::WALL_NONE ) {
-					region_set_water( region, p.x, p.y-1, p.z, average + modyn );
+		int sameDepth = region_neighbourhood_get_water( region, &neighbourhood, x - ox, y - oy, z - oz ) & 0xFF;
+		if ( sameDepth == 0 ) continue;
 
-					uint32_t cx = p.x / region->chunkLength;
-					uint32_t cy = (p.y-1) / region->chunkWidth;
-					uint32_t cz = p.z / region->chunkHeight;
-					uint32_t newChunkIndex = cx + cy*region->length + cz*region->length*region->width;
-					newChunksThatNeedUpdate[ newChunkIndex ] |= Chunk_Mesh_Data_Type::WATER;
-					newWaterThatNeedsUpdate.emplace_back( p.x, p.y-1, p.z, newChunkIndex );
+		fall_water( region, &waterChunk, chunk, &neighbourhood, x, y, z, sameDepth );
+	}
+
+	const int cl = region->chunkLength;
+	const int cw = region->chunkWidth;
+
+	// Cell (x, y) of the layer is at (x+1 + (y+2)*stride) in the grids, there
+	// is an extra row above & below the halo and the rows are a multiple of
+	// 8 cells, so every neighbour of the cells that are updated can be read:
+	const int stride = (cl + 2 + 7) & ~7;
+	const int gridSize = stride * (cw + 4) + 8;
+	waterChunk.denseGrids.resize( gridSize * 7 );
+	int16_t *water = &waterChunk.denseGrids[ 0 ];
+	int16_t *openX = water + gridSize; // -1 if the cell can pass water along x.
+	int16_t *openY = openX + gridSize; // -1 if the cell can pass water along y.
+	int16_t *flowX = openY + gridSize; // The water that flows from a cell to the one at +x.
+	int16_t *flowY = flowX + gridSize; // The water that flows from a cell to the one at +y.
+	int16_t *result = flowY + gridSize;
+	int16_t *stuck = result + gridSize; // -1 if the cell is in a pair that is too close to flow.
+
+	const Water_Chunk *right = ox + cl < (int)region->worldLength ? &region->waterChunks[ chunk+1 ] : nullptr;
+	const Water_Chunk *bottom = oy + cw < (int)region->worldWidth ? &region->waterChunks[ chunk+region->length ] : nullptr;
+
+	for ( int lz = 0; lz < (int)region->chunkHeight; ++lz ) {
+		if ( !waterChunk.denseLayers[ lz ] ) continue;
+		const bool moveRightBorder = !(right && right->dense && right->denseLayers[ lz ]);
+		const bool moveBottomBorder = !(bottom && bottom->dense && bottom->denseLayers[ lz ]);
+		const int z = oz + lz;
+
+		memset( &waterChunk.denseGrids[ 0 ], 0, gridSize * 7 * sizeof(int16_t) );
+
+		for ( int y = -1; y <= cw; ++y ) {
+			for ( int x = -1; x <= cl; ++x ) {
+				const bool insideX = x >= 0 && x < cl;
+				const bool insideY = y >= 0 && y < cw;
+				if ( !insideX && !insideY ) continue;
+				if ( ox+x < 0 || ox+x >= (int)region->worldLength || oy+y < 0 || oy+y >= (int)region->worldWidth ) continue;
+
+				const int p = x+1 + (y+2)*stride;
+				uint32_t wall;
+				if ( insideX && insideY ) {
+					const uint32_t i = x + y*cl + lz*cl*cw;
+					water[ p ] = chunkData->water[ i ];
+					wall = palette_array_get( &chunkData->wall, i );
+				}
+				else {
+					water[ p ] = region_neighbourhood_get_water( region, &neighbourhood, x, y, lz );
+					wall = region_neighbourhood_get_wall( region, &neighbourhood, x, y, lz );
 				}
 
-				region_set_water( region, p.x, p.y, p.z, average );
-				newChunksThatNeedUpdate[ p.w ] |= Chunk_Mesh_Data_Type::WATER;
+				const int16_t open = wall == Wall::WALL_NONE ? -1 : 0;
+				if ( insideY && (x < cl || moveRightBorder) ) openX[ p ] = open;
+				if ( insideX && (y < cw || moveBottomBorder) ) openY[ p ] = open;
 			}
 		}
 
-		lowestWater = newLowestWater;
-		highestWater = newHighestWater;
-
-		region->waterThatNeedsUpdate = std::move( newWaterThatNeedsUpdate );
-		region->numberOfWaterBeingUpdated = region->waterThatNeedsUpdate.size();
+		const int first = stride;
+		const int last = stride * (cw + 3);
+
+	#if SSE_SUPPORT
+		// The rows start on a multiple of 8 cells, so lane k is always at an x of k-1 plus a multiple of 8:
+		int16_t lanes [8];
+		for ( int k = 0; k < 8; ++k ) lanes[ k ] = dense_water_settles( region, ox + k-1, false ) ? -1 : 0;
+		const __m128i settlesX = _mm_loadu_si128( (__m128i*)lanes );
+
+		for ( int p = first; p < last; p += 8 ) {
+			__m128i here = _mm_loadu_si128( (__m128i*)&water[ p ] );
+			__m128i there = _mm_loadu_si128( (__m128i*)&water[ p+1 ] );
+			__m128i open = _mm_and_si128( _mm_loadu_si128( (__m128i*)&openX[ p ] ), _mm_loadu_si128( (__m128i*)&openX[ p+1 ] ) );
+			_mm_storeu_si128( (__m128i*)&flowX[ p ], _mm_and_si128( dense_water_flow( here, there, settlesX ), open ) );
+			__m128i stuckX = _mm_and_si128( dense_water_stuck( here, there ), open );
+
+			const __m128i settlesY = _mm_set1_epi16( dense_water_settles( region, oy + p/stride - 2, true ) ? -1 : 0 );
+			there = _mm_loadu_si128( (__m128i*)&water[ p+stride ] );
+			open = _mm_and_si128( _mm_loadu_si128( (__m128i*)&openY[ p ] ), _mm_loadu_si128( (__m128i*)&openY[ p+stride ] ) );
+			_mm_storeu_si128( (__m128i*)&flowY[ p ], _mm_and_si128( dense_water_flow( here, there, settlesY ), open ) );
+			__m128i stuckY = _mm_and_si128( dense_water_stuck( here, there ), open );
+
+			// A stuck pair marks both of its cells:
+			_mm_storeu_si128( (__m128i*)&stuck[ p ], _mm_or_si128( _mm_loadu_si128( (__m128i*)&stuck[ p ] ), _mm_or_si128( stuckX, stuckY ) ) );
+			_mm_storeu_si128( (__m128i*)&stuck[ p+1 ], _mm_or_si128( _mm_loadu_si128( (__m128i*)&stuck[ p+1 ] ), stuckX ) );
+			_mm_storeu_si128( (__m128i*)&stuck[ p+stride ], _mm_or_si128( _mm_loadu_si128( (__m128i*)&stuck[ p+stride ] ), stuckY ) );
+		}
+		for ( int p = first; p < last; p += 8 ) {
+			__m128i depth = _mm_loadu_si128( (__m128i*)&water[ p ] );
+			depth = _mm_sub_epi16( depth, _mm_loadu_si128( (__m128i*)&flowX[ p ] ) );
+			depth = _mm_add_epi16( depth, _mm_loadu_si128( (__m128i*)&flowX[ p-1 ] ) );
+			depth = _mm_sub_epi16( depth, _mm_loadu_si128( (__m128i*)&flowY[ p ] ) );
+			depth = _mm_add_epi16( depth, _mm_loadu_si128( (__m128i*)&flowY[ p-stride ] ) );
+			_mm_storeu_si128( (__m128i*)&result[ p ], depth );
+		}
+	#else
+		for ( int p = first; p < last; ++p ) {
+			const int x = ox + (p % stride) - 1;
+			const int y = oy + p/stride - 2;
+			flowX[ p ] = dense_water_flow( water[ p ], water[ p+1 ], dense_water_settles( region, x, false ) ) & openX[ p ] & openX[ p+1 ];
+			flowY[ p ] = dense_water_flow( water[ p ], water[ p+stride ], dense_water_settles( region, y, true ) ) & openY[ p ] & openY[ p+stride ];
+			const int16_t stuckX = (dense_water_stuck( water[ p ], water[ p+1 ] ) ? -1 : 0) & openX[ p ] & openX[ p+1 ];
+			const int16_t stuckY = (dense_water_stuck( water[ p ], water[ p+stride ] ) ? -1 : 0) & openY[ p ] & openY[ p+stride ];
+			stuck[ p ] |= stuckX | stuckY;
+			stuck[ p+1 ] |= stuckX;
+			stuck[ p+stride ] |= stuckY;
+		}
+		for ( int p = first; p < last; ++p ) {
+			result[ p ] = water[ p ] - flowX[ p ] + flowX[ p-1 ] - flowY[ p ] + flowY[ p-stride ];
+		}
+	#endif
+
+		for ( int y = -1; y <= cw; ++y ) {
+			const int row = (y+2)*stride;
+			for ( int x = -1; x <= cl; ++x ) {
+				const int p = x+1 + row;
+			#if SSE_SUPPORT
+				// Skip 8 cells at a time while they are unchanged & none of them are stuck:
+				if ( ((x+1) & 7) == 0 && _mm_movemask_epi8( _mm_cmpeq_epi16( _mm_loadu_si128( (__m128i*)&water[ p ] ), _mm_loadu_si128( (__m128i*)&result[ p ] ) ) ) == 0xFFFF && _mm_movemask_epi8( _mm_loadu_si128( (__m128i*)&stuck[ p ] ) ) == 0 ) {
+					x += 7;
+					continue;
+				}
+			#endif
+				const int wx = ox + x;
+				const int wy = oy + y;
+
+				// A cell that is waiting for its turn to settle stays active:
+				if ( stuck[ p ] ) add_active_water( region, waterChunk.added, wx, wy, z );
+				if ( result[ p ] == water[ p ] ) continue;
+
+				set_active_water( region, wx, wy, z, result[ p ] );
+				mark_water_changed( &waterChunk, x >= 0 && x < cl && y >= 0 && y < cw ? chunk : region_get_chunk_index( region, wx, wy, z ) );
+				add_active_water( region, waterChunk.added, wx, wy, z );
+				if ( region_neighbourhood_get_water( region, &neighbourhood, x, y, lz+1 ) > 0 ) add_active_water( region, waterChunk.added, wx, wy, z+1 );
+			}
+		}
 	}
 }
 
 
+//////////////////////////////////
+// This function moves the pairs across the +x
+// (dx = 1) or +y (dy = 1) border of a chunk that
+// was updated by the dense path, for when the
+// dense neighbour that would have moved them
+// was carried over.
+static void move_dense_water_border ( Region *region, uint32_t chunk, int dx, int dy )
+{
+	Water_Chunk& waterChunk = region->waterChunks[ chunk ];
+	const uint32_t neighbour = chunk + dx + dy*region->length;
+
+	Region_Neighbourhood neighbourhood;
+	region_neighbourhood_init( region, &neighbourhood, chunk );
+	const int cl = region->chunkLength;
+	const int cw = region->chunkWidth;
+	const int rows = dx ? cw : cl;
+
+	for ( int lz = 0; lz < (int)region->chunkHeight; ++lz ) {
+		if ( !waterChunk.denseLayers[ lz ] || !region->waterChunks[ neighbour ].denseLayers[ lz ] ) continue;
+
+		for ( int row = 0; row < rows; ++row ) {
+			const int x = dx ? cl-1 : row;
+			const int y = dx ? row : cw-1;
+
+			const int here = region_neighbourhood_get_water( region, &neighbourhood, x, y, lz );
+			const int there = region_neighbourhood_get_water( region, &neighbourhood, x+dx, y+dy, lz );
+			if ( here == there ) continue;
+			if ( region_neighbourhood_get_wall( region, &neighbourhood, x, y, lz ) != Wall::WALL_NONE ) continue;
+			if ( region_neighbourhood_get_wall( region, &neighbourhood, x+dx, y+dy, lz ) != Wall::WALL_NONE ) continue;
+
+			const int flow = dense_water_flow( here, there, dense_water_settles( region, dx ? neighbourhood.ox + x : neighbourhood.oy + y, dy != 0 ) );
+			if ( flow == 0 ) continue;
+
+			const int wx = neighbourhood.ox + x;
+			const int wy = neighbourhood.oy + y;
+			const int z = neighbourhood.oz + lz;
+			set_active_water( region, wx, wy, z, here - flow );
+			set_active_water( region, wx+dx, wy+dy, z, there + flow );
+			mark_water_changed( &waterChunk, chunk );
+			mark_water_changed( &waterChunk, neighbour );
+			add_active_water( region, waterChunk.added, wx, wy, z );
+			add_active_water( region, waterChunk.added, wx+dx, wy+dy, z );
+			if ( region_neighbourhood_get_water( region, &neighbourhood, x, y, lz+1 ) > 0 ) add_active_water( region, waterChunk.added, wx, wy, z+1 );
+			if ( region_neighbourhood_get_water( region, &neighbourhood, x+dx, y+dy, lz+1 ) > 0 ) add_active_water( region, waterChunk.added, wx+dx, wy+dy, z+1 );
+		}
+	}
+}
+
 //////////////////////////////////
 // This function generates the 
 // height data using perlin noise.
@@ -475,93 +1212,198 @@ static float generate_height_data ( float xx, float yy, float scale, int octaves
 // regions data.
 void region_generate ( Region *region )
 {
-	// Generate Data:
-	for ( int z = 0; z < region->height; ++z ) {
-		for ( int y = 0; y < region->width; ++y ) {
-			for ( int x = 0; x < region->length; ++x ) {
-				Chunk_Data *chunk = region_get_chunk( region, x, y, z );
-
-				for ( int cz = 0; cz < region->chunkHeight; ++cz ) {
-					for ( int cy = 0; cy < region->chunkWidth; ++cy ) {
-						for ( int cx = 0; cx < region->chunkLength; ++cx ) {
-							uint32_t *floor = &chunk->floor[ cx + cy*region->chunkLength + cz*region->chunkLength*region->chunkWidth ];
-							uint32_t *wall = &chunk->wall[ cx + cy*region->chunkLength + cz*region->chunkLength*region->chunkWidth ];
-							uint8_t *water = &chunk->water[ cx + cy*region->chunkLength + cz*region->chunkLength*region->chunkWidth ];
-							
-							*floor = Floor::FLOOR_NONE;
-							*wall = Wall::WALL_NONE;
-							*water = 0;
-
-							int genHeight = static_cast<int>(generate_height_data( cx+(x*region->chunkLength), cy+(y*region->chunkWidth), 350, 4, 0.5f, 2.5f, 1 ) * 25.0f ) + 64;
-							if ( genHeight > cz+(z*region->chunkHeight) ) *floor = Floor::FLOOR_STONE;
-							if ( genHeight-1 > cz+(z*region->chunkHeight) ) *wall = Wall::WALL_STONE;
-							
-							if ( cz+(z*region->chunkHeight) == region->worldHeight-1 ) *water = 255; //rand()%256;
-							if ( *water > 0 )region->waterThatNeedsUpdate.emplace_back( cx+(x*region->chunkLength), cy+(y*region->chunkWidth), cz+(z*region->chunkHeight), x + y*region->length + z*region->length*region->width );
-						}
-					}
+	PROFILE_ZONE( ZONE_GENERATE );
+	const uint64_t startTime = Profiler::get_time();
+
+	// The water's random sequences are derived from the seed & tick:
+	region->waterTick = 0;
+
+	// The edits still waiting were made to the old tiles:
+	region->deferredEdits.clear();
+
+	// NOTE(Xavier): (2018.1.14) The meshers may still be building the old
+	// chunks. New ones give up while 'chunkDataGenerated' is false, & every
+	// chunk is claimed the same way a tile edit claims one, waiting for the
+	// meshers that are already building it, so nothing reads the tiles while
+	// the passes rewrite them.
+	const uint32_t chunkCount = region->length*region->width*region->height;
+	region->chunkDataGenerated = false;
+	for ( uint32_t i = 0; i < chunkCount; ++i ) {
+		while ( region->chunksBeingMeshed[ i ].exchange( true ) ) std::this_thread::yield();
+	}
+
+	memset( region->waterSettledDepth, 0, region->worldLength*region->worldWidth*region->worldHeight );
+	memset( region->waterWokenTicks, 0, region->worldLength*region->worldWidth*region->worldHeight*sizeof(uint16_t) );
+	memset( region->waterAsleep, 0, region->worldLength*region->worldWidth*region->worldHeight );
+	region->numberOfWaterSleeping = 0;
+
+	// NOTE(Xavier): (2018.1.13) Each pass (heights, tiles, occlusion, packing)
+	// is split into columns of chunks that are run on the job system,
+	// 'job_system_run' returns once every column is done so each pass only
+	// starts when the one before it has finished. The occlusion pass reads the
+	// tiles of the neighbouring columns, so it only records which tiles are
+	// hidden & the last pass adds the bits, once nothing is reading the tiles.
+	Generation_Pass pass;
+	pass.region = region;
+	pass.columnWater.resize( region->length*region->width );
+	pass.occlusionWords = (region->chunkLength*region->chunkWidth*region->chunkHeight + 63) / 64;
+	pass.occlusion.assign( pass.occlusionWords * 2 * region->length*region->width*region->height, 0 );
+
+	Job_System *jobSystem = get_job_system( region );
+	job_system_run( jobSystem, region->length*region->width, generate_column_heights, &pass );
+	job_system_run( jobSystem, region->length*region->width, generate_column_tiles, &pass );
+	job_system_run( jobSystem, region->length*region->width, generate_column_occlusion, &pass );
+	job_system_run( jobSystem, region->length*region->width, pack_column_occlusion, &pass );
+
+	// The water is added in the same order as if the chunks had been generated one by one:
+	for ( auto& water : pass.columnWater ) {
+		for ( uint32_t index : water ) add_active_water_cell( region, region->activeWater, index );
+	}
+
+	// The meshers can start as soon as the chunks are published,
+	// so they must already see that the data has been generated:
+	for ( uint32_t i = 0; i < chunkCount; ++i ) region->chunksBeingMeshed[ i ] = false;
+	region->chunkDataGenerated = true;
+	for ( uint32_t i = 0; i < chunkCount; ++i ) {
+		mark_chunk_changed( region, i, Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER );
+	}
+	publish_changed_chunks( region );
+
+	// Chunks that were already dirty are not signalled again when they are
+	// marked, & the meshers gave up on them while there was no data:
+	if ( region->meshWork != nullptr ) region->meshWork();
+
+	region->generationTime = Profiler::get_time() - startTime;
+}
+
+
+//////////////////////////////////
+// This function computes the height of the
+// terrain under a column of chunks.
+// NOTE(Xavier): (2018.1.13) The height only depends on the location along
+// x & y, so it is computed once per column of cells into 'heightMap' instead
+// of for every cell of the column. The map is kept after generation.
+static void generate_column_heights ( void *data, uint32_t column )
+{
+	Generation_Pass *pass = (Generation_Pass*)data;
+	Region *region = pass->region;
+	const int x = column % region->length;
+	const int y = column / region->length;
+
+	for ( int cy = 0; cy < (int)region->chunkWidth; ++cy ) {
+		for ( int cx = 0; cx < (int)region->chunkLength; ++cx ) {
+			const int xx = cx+(x*region->chunkLength);
+			const int yy = cy+(y*region->chunkWidth);
+			region->heightMap[ xx + yy*region->worldLength ] = static_cast<int>(generate_height_data( xx, yy, 350, 4, 0.5f, 2.5f, 1 ) * 25.0f ) + 64;
+		}
+	}
+}
+
+//////////////////////////////////
+// This function fills the tiles & water of the
+// chunks in a column of chunks from the height
+// map, & records the water it adds (the cells at
+// the top of the region) for 'region_generate'
+// to activate.
+static void generate_column_tiles ( void *data, uint32_t column )
+{
+	Generation_Pass *pass = (Generation_Pass*)data;
+	Region *region = pass->region;
+	const int x = column % region->length;
+	const int y = column / region->length;
+
+	// Each chunk's tiles are generated into these, then packed:
+	std::vector<uint32_t> floors ( region->chunkLength*region->chunkWidth*region->chunkHeight );
+	std::vector<uint32_t> walls ( region->chunkLength*region->chunkWidth*region->chunkHeight );
+
+	for ( int z = 0; z < (int)region->height; ++z ) {
+		Chunk_Data *chunk = region_get_chunk( region, x, y, z );
+
+		for ( int cz = 0; cz < (int)region->chunkHeight; ++cz ) {
+			for ( int cy = 0; cy < (int)region->chunkWidth; ++cy ) {
+				for ( int cx = 0; cx < (int)region->chunkLength; ++cx ) {
+					const uint32_t i = cx + cy*region->chunkLength + cz*region->chunkLength*region->chunkWidth;
+					uint8_t *water = &chunk->water[ i ];
+					*water = 0;
+
+					const int genHeight = region->heightMap[ cx+(x*region->chunkLength) + (cy+(y*region->chunkWidth))*region->worldLength ];
+					const int wz = cz + z*(int)region->chunkHeight;
+					floors[i] = genHeight > wz ? Floor::FLOOR_STONE : Floor::FLOOR_NONE;
+					walls[i] = genHeight-1 > wz ? Wall::WALL_STONE : Wall::WALL_NONE;
+					
+					if ( wz == (int)region->worldHeight-1 ) *water = 255; //rand()%256;
+					if ( *water > 0 ) pass->columnWater[ column ].push_back( (cx+(x*region->chunkLength)) + (cy+(y*region->chunkWidth))*region->worldLength + (cz+(z*region->chunkHeight))*region->worldLength*region->worldWidth );
 				}
 			}
 		}
-	}
 
-	// Generate Occlusion:
-	for ( int z = 0; z < region->height; ++z ) {
-		for ( int y = 0; y < region->width; ++y ) {
-			for ( int x = 0; x < region->length; ++x ) {
-				Chunk_Data *chunk = region_get_chunk( region, x, y, z );
-
-				for ( int cz = 0; cz < region->chunkHeight; ++cz ) {
-					for ( int cy = 0; cy < region->chunkWidth; ++cy ) {
-						for ( int cx = 0; cx < region->chunkLength; ++cx ) {
-							uint32_t* floor = &chunk->floor[ cx + cy*region->chunkLength + cz*region->chunkLength*region->chunkWidth ];
-							uint32_t* wall = &chunk->wall[ cx + cy*region->chunkLength + cz*region->chunkLength*region->chunkWidth ];
-							
-							int xx = cx+(x*region->chunkLength);
-							int yy = cy+(y*region->chunkWidth);
-							int zz = cz+(z*region->chunkHeight);
-
-							// TODO(Xavier): (2017.12.25)
-							// Cleanup this occlusion code.
-							if ( *floor != Floor::FLOOR_NONE ) {
-								if ( region_get_floor(region, xx-1, yy, zz) != Floor::FLOOR_NONE && region_get_floor(region, xx, yy-1, zz) != Floor::FLOOR_NONE && region_get_wall(region, xx, yy, zz) != Wall::WALL_NONE ) {
-									if ( region_get_floor(region, xx+1, yy, zz) != Floor::FLOOR_NONE && region_get_floor(region, xx, yy-1, zz) != Floor::FLOOR_NONE && region_get_wall(region, xx, yy, zz) != Wall::WALL_NONE ) {
-										if ( region_get_floor(region, xx+1, yy, zz) != Floor::FLOOR_NONE && region_get_floor(region, xx, yy+1, zz) != Floor::FLOOR_NONE && region_get_wall(region, xx, yy, zz) != Wall::WALL_NONE ) {
-											if ( region_get_floor(region, xx-1, yy, zz) != Floor::FLOOR_NONE && region_get_floor(region, xx, yy+1, zz) != Floor::FLOOR_NONE && region_get_wall(region, xx, yy, zz) != Wall::WALL_NONE ) {
-												*floor |= OCCLUSION_BIT;
-											}
-										}
-									}
-								}
-							}
+		palette_array_assign( &chunk->floor, &floors[0] );
+		palette_array_assign( &chunk->wall, &walls[0] );
+	}
+}
 
-							if ( *wall != Wall::WALL_NONE ) {
-								if ( region_get_wall(region, xx-1, yy, zz) != Wall::WALL_NONE && region_get_wall(region, xx, yy-1, zz) != Wall::WALL_NONE && region_get_floor(region, xx, yy, zz+1) != Floor::FLOOR_NONE ) {
-									if ( region_get_wall(region, xx+1, yy, zz) != Wall::WALL_NONE && region_get_wall(region, xx, yy-1, zz) != Wall::WALL_NONE && region_get_floor(region, xx, yy, zz+1) != Floor::FLOOR_NONE ) {
-										if ( region_get_wall(region, xx+1, yy, zz) != Wall::WALL_NONE && region_get_wall(region, xx, yy+1, zz) != Wall::WALL_NONE && region_get_floor(region, xx, yy, zz+1) != Floor::FLOOR_NONE ) {
-											if ( region_get_wall(region, xx-1, yy, zz) != Wall::WALL_NONE && region_get_wall(region, xx, yy+1, zz) != Wall::WALL_NONE && region_get_floor(region, xx, yy, zz+1) != Floor::FLOOR_NONE ) {
-												*wall |= OCCLUSION_BIT;
-											}
-										}
-									}
-								}
-							}
-						}
-					}
+//////////////////////////////////
+// This function records which tiles of the
+// chunks in a column of chunks are hidden.
+static void generate_column_occlusion ( void *data, uint32_t column )
+{
+	Generation_Pass *pass = (Generation_Pass*)data;
+	Region *region = pass->region;
+
+	for ( uint32_t z = 0; z < region->height; ++z ) {
+		const uint32_t chunkIndex = column + z*region->length*region->width;
+		Chunk_Data *chunk = &region->chunks[ chunkIndex ];
+		uint64_t *floorBits = &pass->occlusion[ chunkIndex * 2 * pass->occlusionWords ];
+		uint64_t *wallBits = floorBits + pass->occlusionWords;
+
+		Region_Neighbourhood neighbourhood;
+		region_neighbourhood_init( region, &neighbourhood, chunkIndex );
+
+		for ( int cz = 0; cz < (int)region->chunkHeight; ++cz ) {
+			for ( int cy = 0; cy < (int)region->chunkWidth; ++cy ) {
+				for ( int cx = 0; cx < (int)region->chunkLength; ++cx ) {
+					const uint32_t i = cx + cy*neighbourhood.strideY + cz*neighbourhood.strideZ;
+					uint32_t floor = palette_array_get( &chunk->floor, i );
+					uint32_t wall = palette_array_get( &chunk->wall, i );
+					get_occlusion( region, &neighbourhood, cx, cy, cz, &floor, &wall );
+					if ( floor & OCCLUSION_BIT ) floorBits[ i >> 6 ] |= 1ull << (i & 63);
+					if ( wall & OCCLUSION_BIT ) wallBits[ i >> 6 ] |= 1ull << (i & 63);
 				}
 			}
 		}
 	}
+}
 
-	region->chunksNeedingMeshUpdate_mutex.lock();
-	
-	for ( uint32_t i = 0; i < region->length*region->width*region->height; ++i ) {
-		region->chunksNeedingMeshUpdate[i] = Chunk_Mesh_Data_Type::FLOOR | Chunk_Mesh_Data_Type::WALL | Chunk_Mesh_Data_Type::WATER;
+//////////////////////////////////
+// This function adds the occlusion bits recorded
+// by 'generate_column_occlusion' to the tiles of
+// the chunks in a column of chunks.
+static void pack_column_occlusion ( void *data, uint32_t column )
+{
+	Generation_Pass *pass = (Generation_Pass*)data;
+	Region *region = pass->region;
+	const uint32_t chunkSize = region->chunkLength*region->chunkWidth*region->chunkHeight;
+	std::vector<uint32_t> tiles ( chunkSize );
+
+	for ( uint32_t z = 0; z < region->height; ++z ) {
+		const uint32_t chunkIndex = column + z*region->length*region->width;
+		Chunk_Data *chunk = &region->chunks[ chunkIndex ];
+		const uint64_t *bits = &pass->occlusion[ chunkIndex * 2 * pass->occlusionWords ];
+
+		for ( Palette_Array *array : { &chunk->floor, &chunk->wall } ) {
+			bool hidden = false;
+			for ( uint32_t w = 0; w < pass->occlusionWords; ++w ) hidden |= bits[w] != 0;
+
+			if ( hidden ) {
+				for ( uint32_t i = 0; i < chunkSize; ++i ) {
+					tiles[i] = palette_array_get( array, i );
+					if ( (bits[ i >> 6 ] >> (i & 63)) & 1 ) tiles[i] |= OCCLUSION_BIT;
+				}
+				palette_array_assign( array, &tiles[0] );
+			}
+			bits += pass->occlusionWords;
+		}
 	}
-	
-	region->chunksNeedingMeshUpdate_mutex.unlock();
-
-	region->chunkDataGenerated = true;
 }
 
 
@@ -599,7 +1441,7 @@ void region_load ( Region *region )
 // at the specified loaction.
 inline Chunk_Data* region_get_chunk ( Region *region, int x, int y, int z )
 {
-	if ( x < 0 || x >= region->length || y < 0 || y >= region->width || z < 0 || z >= region->height ) return nullptr;
+	if ( x < 0 || x >= (int)region->length || y < 0 || y >= (int)region->width || z < 0 || z >= (int)region->height ) return nullptr;
 	return &region->chunks[ x + y*region->length + z*region->length*region->width ];
 }
 
@@ -608,14 +1450,9 @@ inline Chunk_Data* region_get_chunk ( Region *region, int x, int y, int z )
 // of a floor at a location.
 inline uint32_t region_get_floor ( Region *region, int x, int y, int z )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return 0;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	return region_get_chunk( region, cx, cy, cz )->floor[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ];
+	uint32_t index;
+	Chunk_Data *chunk = region_locate( region, x, y, z, &index );
+	return chunk != nullptr ? palette_array_get( &chunk->floor, index ) : 0;
 }
 
 //////////////////////////////////
@@ -623,14 +1460,9 @@ inline uint32_t region_get_floor ( Region *region, int x, int y, int z )
 // of a wall at a loaction.
 inline uint32_t region_get_wall ( Region *region, int x, int y, int z )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return 0;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	return region_get_chunk( region, cx, cy, cz )->wall[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ];
+	uint32_t index;
+	Chunk_Data *chunk = region_locate( region, x, y, z, &index );
+	return chunk != nullptr ? palette_array_get( &chunk->wall, index ) : 0;
 }
 
 //////////////////////////////////
@@ -638,14 +1470,9 @@ inline uint32_t region_get_wall ( Region *region, int x, int y, int z )
 // of water at a loaction.
 inline uint32_t region_get_water ( Region *region, int x, int y, int z )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return 0;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	return region_get_chunk( region, cx, cy, cz )->water[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ];
+	uint32_t index;
+	Chunk_Data *chunk = region_locate( region, x, y, z, &index );
+	return chunk != nullptr ? chunk->water[ index ] : 0;
 }
 
 //////////////////////////////////
@@ -653,14 +1480,9 @@ inline uint32_t region_get_water ( Region *region, int x, int y, int z )
 // of a floor at a loaction.
 inline void region_set_floor ( Region *region, int x, int y, int z, uint32_t floor )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	region_get_chunk( region, cx, cy, cz )->floor[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ] = floor;
+	uint32_t index;
+	Chunk_Data *chunk = region_locate( region, x, y, z, &index );
+	if ( chunk != nullptr ) palette_array_set( &chunk->floor, index, floor );
 }
 
 //////////////////////////////////
@@ -668,14 +1490,9 @@ inline void region_set_floor ( Region *region, int x, int y, int z, uint32_t flo
 // of a wall at a loaction.
 inline void region_set_wall ( Region *region, int x, int y, int z, uint32_t wall )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	region_get_chunk( region, cx, cy, cz )->wall[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ] = wall;
+	uint32_t index;
+	Chunk_Data *chunk = region_locate( region, x, y, z, &index );
+	if ( chunk != nullptr ) palette_array_set( &chunk->wall, index, wall );
 }
 
 //////////////////////////////////
@@ -683,12 +1500,40 @@ inline void region_set_wall ( Region *region, int x, int y, int z, uint32_t wall
 // of water at a loaction.
 inline void region_set_water ( Region *region, int x, int y, int z, uint32_t water )
 {
-	if ( x < 0 || x >= region->worldLength || y < 0 || y >= region->worldWidth || z < 0 || z >= region->worldHeight ) return;
-	uint32_t cx = x / region->chunkLength;
-	uint32_t cy = y / region->chunkWidth;
-	uint32_t cz = z / region->chunkHeight;
-	uint32_t lx = x % region->chunkLength;
-	uint32_t ly = y % region->chunkWidth;
-	uint32_t lz = z % region->chunkHeight;
-	region_get_chunk( region, cx, cy, cz )->water[ lx + ly*region->chunkLength + lz*region->chunkLength*region->chunkWidth ] = water;
-}
\ No newline at end of file
+	uint32_t index;
+	Chunk_Data *chunk = region_locate( region, x, y, z, &index );
+	if ( chunk != nullptr ) chunk->water[ index ] = water;
+}
+
+//////////////////////////////////
+// This function returns the value of a
+// floor in or next to the chunk of a
+// neighbourhood.
+inline uint32_t region_neighbourhood_get_floor ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z )
+{
+	uint32_t index;
+	Chunk_Data *chunk = region_neighbourhood_locate( region, neighbourhood, x, y, z, &index );
+	return chunk != nullptr ? palette_array_get( &chunk->floor, index ) : 0;
+}
+
+//////////////////////////////////
+// This function returns the value of a
+// wall in or next to the chunk of a
+// neighbourhood.
+inline uint32_t region_neighbourhood_get_wall ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z )
+{
+	uint32_t index;
+	Chunk_Data *chunk = region_neighbourhood_locate( region, neighbourhood, x, y, z, &index );
+	return chunk != nullptr ? palette_array_get( &chunk->wall, index ) : 0;
+}
+
+//////////////////////////////////
+// This function returns the value of
+// water in or next to the chunk of a
+// neighbourhood.
+inline uint32_t region_neighbourhood_get_water ( Region *region, const Region_Neighbourhood *neighbourhood, int x, int y, int z )
+{
+	uint32_t index;
+	Chunk_Data *chunk = region_neighbourhood_locate( region, neighbourhood, x, y, z, &index );
+	return chunk != nullptr ? chunk->water[ index ] : 0;
+}
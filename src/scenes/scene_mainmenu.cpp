@@ -96,7 +96,7 @@ void MainMenu_Scene::simulate()
 
 //////////////////////////////////////
 // Generation Thread - Methods:
-bool MainMenu_Scene::generate()
+bool MainMenu_Scene::generate( uint32_t /*mesher*/ )
 {
 	// This will never be called ( idealy ).
 	return false;
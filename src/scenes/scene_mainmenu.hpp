@@ -31,7 +31,7 @@ public:
 
 	///////////////////////////
 	// Generation Thread Methods:
-	bool generate() override;
+	bool generate( uint32_t mesher ) override;
 
 	////////////////
 	// Destructor:
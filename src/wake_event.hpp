@@ -0,0 +1,55 @@
+#ifndef _WAKE_EVENT_HPP_
+#define _WAKE_EVENT_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+/////////////////////////////////
+// NOTE(Xavier): (2018.1.11) A wake event lets threads sleep until
+// another thread says there may be something for them to do.
+// Every signal increments a counter, a waiting thread sleeps until
+// the counter differs from the value it read. The count must be read
+// BEFORE the thread checks for work, so a signal sent between the
+// check & the wait is not missed.
+// Signalling only takes the lock when a thread is waiting, so the
+// producers can signal on every bit of work they make.
+struct Wake_Event
+{
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::atomic<uint32_t> count { 0 };
+	std::atomic<uint32_t> waiters { 0 };
+};
+
+/////////////////////////////////
+inline uint32_t wake_event_count ( Wake_Event *event )
+{
+	return event->count.load();
+}
+
+/////////////////////////////////
+// Returns once the event has been
+// signalled since 'count' was read.
+inline void wake_event_wait ( Wake_Event *event, uint32_t count )
+{
+	std::unique_lock<std::mutex> lock( event->mutex );
+	event->waiters++;
+	event->condition.wait( lock, [&]{ return event->count.load() != count; } );
+	event->waiters--;
+}
+
+/////////////////////////////////
+inline void wake_event_signal ( Wake_Event *event )
+{
+	event->count++;
+	if ( event->waiters.load() != 0 ) {
+		// The lock makes sure a waiter is either asleep or
+		// has not checked the count yet:
+		std::lock_guard<std::mutex> lock( event->mutex );
+		event->condition.notify_all();
+	}
+}
+
+#endif